@@ -1,5 +1,6 @@
-#include "binding.hpp"
+#include "sqlitestore.hpp"
 #include <gtest/gtest.h>
+#include <map>
 
 using namespace MyMQ;
 
@@ -10,7 +11,7 @@ class BindingTest : public testing::Environment
 public:
     void SetUp() override
     {
-        bmp = std::make_shared<BindingManager>("./data/meta.db");
+        bmp = std::make_shared<BindingManager>(std::make_shared<SqliteMetaStore>("./data/meta.db"));
     }
 
     void TearDown() override
@@ -57,6 +58,135 @@ TEST(BindTest, UnBind)
     EXPECT_EQ(bmp->Exists("exchange2", "queue3"), true);
 }
 
+TEST(BindTest, RouteCache)
+{
+    bmp->Bind("exchange3", "queue1", "news.music.#", false);
+    auto first = bmp->Route("exchange3", ExchangeType::TOPIC, "news.music.pop");
+    ASSERT_EQ(first->size(), 1);
+    // 拓扑未变化时直接命中缓存
+    ASSERT_EQ(bmp->Route("exchange3", ExchangeType::TOPIC, "news.music.pop"), first);
+
+    bmp->Bind("exchange3", "queue2", "news.*.pop", false);
+    ASSERT_EQ(bmp->Route("exchange3", ExchangeType::TOPIC, "news.music.pop")->size(), 2);
+
+    bmp->UnBind("exchange3", "queue1");
+    auto last = bmp->Route("exchange3", ExchangeType::TOPIC, "news.music.pop");
+    ASSERT_EQ(last->size(), 1);
+    ASSERT_EQ(last->front()->msgqueue_name, "queue2");
+
+    bmp->RemoveExchangeBindings("exchange3");
+    ASSERT_EQ(bmp->Route("exchange3", ExchangeType::TOPIC, "news.music.pop")->size(), 0);
+}
+
+TEST(BindTest, TypedRoute)
+{
+    bmp->Bind("exchange4", "queue1", "news", false);
+    bmp->Bind("exchange4", "queue2", "news", false);
+    bmp->Bind("exchange4", "queue3", "sport", false);
+    // 登记类型后按 DIRECT 索引重建
+    bmp->DeclareExchange("exchange4", ExchangeType::DIRECT);
+    ASSERT_EQ(bmp->Route("exchange4", ExchangeType::DIRECT, "news")->size(), 2);
+    ASSERT_EQ(bmp->Route("exchange4", ExchangeType::DIRECT, "music")->size(), 0);
+    bmp->UnBind("exchange4", "queue1");
+    ASSERT_EQ(bmp->Route("exchange4", ExchangeType::DIRECT, "news")->size(), 1);
+    bmp->UnBind("exchange4", "queue2");
+    ASSERT_EQ(bmp->Route("exchange4", ExchangeType::DIRECT, "news")->size(), 0);
+    ASSERT_EQ(bmp->Route("exchange4", ExchangeType::DIRECT, "sport")->size(), 1);
+
+    bmp->DeclareExchange("exchange5", ExchangeType::FANOUT);
+    bmp->Bind("exchange5", "queue1", "", false);
+    bmp->Bind("exchange5", "queue2", "", false);
+    auto all = bmp->Route("exchange5", ExchangeType::FANOUT, "anything");
+    ASSERT_EQ(all->size(), 2);
+    bmp->UnBind("exchange5", "queue1");
+    ASSERT_EQ(bmp->Route("exchange5", ExchangeType::FANOUT, "anything")->size(), 1);
+    // 旧快照不受影响
+    ASSERT_EQ(all->size(), 2);
+}
+
+TEST(BindTest, HeadersRoute)
+{
+    google::protobuf::Map<std::string, std::string> all, any, none;
+    all["x-match"] = "all";
+    all["region"] = "eu";
+    all["tier"] = "gold";
+    any["x-match"] = "any";
+    any["region"] = "eu";
+    any["tenant"] = "acme";
+
+    bmp->DeclareExchange("exchange6", ExchangeType::HEADERS);
+    bmp->Bind("exchange6", "queue1", "", true, all);
+    bmp->Bind("exchange6", "queue2", "", true, any);
+    bmp->Bind("exchange6", "queue3", "", true, none);   // 无条件匹配
+
+    auto route = [](std::initializer_list<std::pair<const std::string, std::string>> headers) {
+        google::protobuf::Map<std::string, std::string> h(headers.begin(), headers.end());
+        auto targets = bmp->RouteHeaders("exchange6", h);
+        std::vector<std::string> names;
+        for(auto& bp : *targets)
+            names.push_back(bp->msgqueue_name);
+        std::sort(names.begin(), names.end());
+        return names;
+    };
+
+    using Names = std::vector<std::string>;
+    ASSERT_EQ(route({{"region", "eu"}, {"tier", "gold"}}), (Names{"queue1", "queue2", "queue3"}));
+    ASSERT_EQ(route({{"region", "eu"}, {"tier", "silver"}}), (Names{"queue2", "queue3"}));
+    ASSERT_EQ(route({{"tenant", "acme"}}), (Names{"queue2", "queue3"}));
+    ASSERT_EQ(route({{"region", "us"}}), (Names{"queue3"}));
+
+    bmp->UnBind("exchange6", "queue2");
+    ASSERT_EQ(route({{"region", "eu"}, {"tier", "gold"}}), (Names{"queue1", "queue3"}));
+
+    // 重新加载后绑定条件保持不变
+    BindingManager reloaded(std::make_shared<SqliteMetaStore>("./data/meta.db"));
+    reloaded.DeclareExchange("exchange6", ExchangeType::HEADERS);
+    google::protobuf::Map<std::string, std::string> h;
+    h["region"] = "eu";
+    h["tier"] = "gold";
+    ASSERT_EQ(reloaded.RouteHeaders("exchange6", h)->size(), 2);
+}
+
+TEST(BindTest, ConsistentHash)
+{
+    bmp->DeclareExchange("exchange7", ExchangeType::CONSISTENT_HASH);
+    bmp->Bind("exchange7", "queue1", "1", false);
+    bmp->Bind("exchange7", "queue2", "1", false);
+    bmp->Bind("exchange7", "queue3", "2", false);
+
+    std::map<std::string, std::string> before;
+    std::map<std::string, int> counts;
+    for(int i = 0; i < 4000; ++i)
+    {
+        std::string key = "order." + std::to_string(i);
+        auto targets = bmp->RouteHash("exchange7", key);
+        ASSERT_EQ(targets->size(), 1);
+        ASSERT_EQ(bmp->RouteHash("exchange7", key)->front(), targets->front());
+        before[key] = targets->front()->msgqueue_name;
+        ++counts[before[key]];
+    }
+    // 权重为 2 的队列分得更多的键
+    ASSERT_GT(counts["queue3"], counts["queue1"]);
+    ASSERT_GT(counts["queue3"], counts["queue2"]);
+
+    // 新增队列只迁移一小部分键，且只迁往新队列
+    bmp->Bind("exchange7", "queue4", "1", false);
+    int moved = 0;
+    for(auto& it : before)
+    {
+        auto now = bmp->RouteHash("exchange7", it.first)->front()->msgqueue_name;
+        if(now == it.second)    continue;
+        ASSERT_EQ(now, "queue4");
+        ++moved;
+    }
+    ASSERT_GT(moved, 0);
+    ASSERT_LT(moved, 4000 * 3 / 10);
+
+    bmp->UnBind("exchange7", "queue4");
+    for(auto& it : before)
+        ASSERT_EQ(bmp->RouteHash("exchange7", it.first)->front()->msgqueue_name, it.second);
+}
+
 int main()
 {
     testing::InitGoogleTest();
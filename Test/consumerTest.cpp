@@ -76,6 +76,75 @@ TEST_F(ConsumerTest, remove)
     ASSERT_EQ(cmp->Exists("c3", "queue1"), false);
 }
 
+TEST_F(ConsumerTest, prefetch)
+{
+    auto c1 = cmp->Create("c1", "queue1", false, func);
+    auto c2 = cmp->Create("c2", "queue1", false, func);
+    c1->prefetch_count = 2;
+    c2->prefetch_count = 1;
+
+    // 额度用完的消费者被跳过
+    ASSERT_EQ(cmp->Choose("queue1"), c1);
+    ASSERT_EQ(cmp->Choose("queue1"), c2);
+    ASSERT_EQ(cmp->Choose("queue1"), c1);
+    ASSERT_EQ(cmp->Choose("queue1"), nullptr);
+
+    // 确认后归还额度
+    c2->Release(0);
+    ASSERT_EQ(cmp->Choose("queue1"), c2);
+    ASSERT_EQ(cmp->Choose("queue1"), nullptr);
+
+    // 字节数限制
+    c1->Release(0);
+    c1->prefetch_size = 100;
+    ASSERT_EQ(cmp->Choose("queue1"), c1);
+    c1->Charge(100);
+    c1->Release(0);
+    ASSERT_EQ(cmp->Choose("queue1"), nullptr);
+    // 创建时带上限制，消费者可见时额度已生效
+    ConsumerLimits limits;
+    limits.prefetch_count = 1;
+    limits.max_batch = 0;
+    auto c3 = cmp->Create("c3", "queue1", false, func, {}, 0, limits);
+    ASSERT_EQ(c3->max_batch, 1);
+    ASSERT_EQ(cmp->Choose("queue1"), c3);
+    ASSERT_EQ(cmp->Choose("queue1"), nullptr);
+}
+
+TEST_F(ConsumerTest, strategy)
+{
+    // 优先级：高优先级有额度时总是选它，额度用完才轮到低优先级
+    cmp->InitQueueConsumer("queue2", ConsumerStrategy::PRIORITY);
+    auto low = cmp->Create("low", "queue2", false, func, {}, 1);
+    auto high = cmp->Create("high", "queue2", false, func, {}, 10);
+    high->prefetch_count = 2;
+    ASSERT_EQ(cmp->Choose("queue2"), high);
+    ASSERT_EQ(cmp->Choose("queue2"), high);
+    ASSERT_EQ(cmp->Choose("queue2"), low);
+    high->Release(0);
+    ASSERT_EQ(cmp->Choose("queue2"), high);
+
+    // 未确认最少
+    cmp->InitQueueConsumer("queue3", ConsumerStrategy::LEAST_UNACKED);
+    auto c1 = cmp->Create("c1", "queue3", false, func);
+    auto c2 = cmp->Create("c2", "queue3", false, func);
+    c1->unacked = 5;
+    ASSERT_EQ(cmp->Choose("queue3"), c2);
+    ASSERT_EQ(cmp->Choose("queue3"), c2);
+    c2->unacked = 9;
+    ASSERT_EQ(cmp->Choose("queue3"), c1);
+
+    // 两个消费者时 power-of-two 总是比较两者
+    cmp->InitQueueConsumer("queue4", ConsumerStrategy::POWER_OF_TWO);
+    auto p1 = cmp->Create("p1", "queue4", false, func);
+    auto p2 = cmp->Create("p2", "queue4", false, func);
+    p1->unacked = 3;
+    for(int i = 0; i < 3; ++i)
+        ASSERT_EQ(cmp->Choose("queue4"), p2);
+    p2->prefetch_count = 3;
+    ASSERT_EQ(cmp->Choose("queue4"), p1);
+}
+
 int main()
 {
     testing::InitGoogleTest();
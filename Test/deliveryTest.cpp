@@ -0,0 +1,191 @@
+#include "delivery.hpp"
+#include <gtest/gtest.h>
+
+using namespace MyMQ;
+
+class DeliveryTest : public testing::Test
+{
+public:
+    void SetUp() override
+    {
+        mmp = std::make_shared<MessageManager>("./data/delivery/");
+        mmp->InitQueueManager("queue1");
+        google::protobuf::Map<std::string, std::string> empty;
+        queue = std::make_shared<QueueHandle>(std::make_shared<MsgQueue>("queue1", false, false, false, empty),
+                                              mmp->GetQueueMessage("queue1"),
+                                              std::make_shared<QueueConsumer>("queue1"));
+        for(int i = 0; i < 5; ++i)
+            queue->messages->Insert(nullptr, "Hello World-" + std::to_string(i), false);
+    }
+
+    void TearDown() override
+    {
+        mmp->Clear();
+    }
+
+    // 取出一条消息并登记到窗口
+    uint64_t deliverOne()
+    {
+        MessageId id;
+        auto msg = queue->messages->Front(&id);
+        return window.Push(queue, msg, id);
+    }
+
+    MessageManagerPtr mmp;
+    QueueHandlePtr queue;
+    DeliveryWindow window;
+};
+
+TEST_F(DeliveryTest, tags)
+{
+    for(uint64_t i = 1; i <= 5; ++i)
+        ASSERT_EQ(deliverOne(), i);
+    ASSERT_EQ(window.Unacked(), 5);
+    ASSERT_EQ(queue->messages->GetWaitackCount(), 5);
+
+    // 乱序确认，重复确认与越界标签被拒绝
+    Delivery d;
+    ASSERT_EQ(window.Ack(3, d), true);
+    ASSERT_EQ(d.msg->payload().body(), "Hello World-2");
+    ASSERT_EQ(queue->messages->Remove(d.id), true);
+    ASSERT_EQ(window.Ack(3, d), false);
+    ASSERT_EQ(window.Ack(0, d), false);
+    ASSERT_EQ(window.Ack(6, d), false);
+
+    for(uint64_t tag : {1, 2, 4, 5})
+    {
+        ASSERT_EQ(window.Ack(tag, d), true);
+        queue->messages->Remove(d.id);
+    }
+    ASSERT_EQ(window.Unacked(), 0);
+    ASSERT_EQ(queue->messages->GetWaitackCount(), 0);
+}
+
+TEST_F(DeliveryTest, ackId)
+{
+    std::vector<MessageId> ids;
+    for(int i = 0; i < 3; ++i)
+    {
+        MessageId id;
+        auto msg = queue->messages->Front(&id);
+        ASSERT_EQ(window.Push(queue, msg, id), i + 1);
+        ids.push_back(id);
+    }
+
+    // 按消息 ID 确认与按标签确认结清的是同一项
+    Delivery d;
+    ASSERT_EQ(window.AckId(ids[1], d), true);
+    ASSERT_EQ(d.msg->payload().body(), "Hello World-1");
+    ASSERT_EQ(window.Ack(2, d), false);
+    ASSERT_EQ(window.AckId(ids[1], d), false);
+    ASSERT_EQ(window.Unacked(), 2);
+
+    ASSERT_EQ(window.Ack(1, d), true);
+    ASSERT_EQ(window.AckId(ids[2], d), true);
+    ASSERT_EQ(window.Unacked(), 0);
+    for(auto& id : ids)
+        queue->messages->Remove(id);
+}
+
+TEST_F(DeliveryTest, batch)
+{
+    for(int i = 0; i < 3; ++i)
+        queue->messages->Insert(nullptr, "Durable-" + std::to_string(i), true);
+    for(uint64_t i = 1; i <= 8; ++i)
+        ASSERT_EQ(deliverOne(), i);
+    ASSERT_EQ(queue->messages->GetDurableCount(), 3);
+
+    auto ids = [](const std::vector<Delivery>& acked) {
+        std::vector<MessageId> result;
+        for(auto& d : acked)    result.push_back(d.id);
+        return result;
+    };
+
+    // 确认 1~3
+    std::vector<Delivery> acked;
+    ASSERT_EQ(window.AckUpTo(3, acked), 3);
+    ASSERT_EQ(queue->messages->Remove(ids(acked)), 3);
+    ASSERT_EQ(window.AckUpTo(3, acked), 0);
+
+    // 区间 [5, 7] 含两条持久化消息
+    acked.clear();
+    ASSERT_EQ(window.AckRange(5, 7, acked), 3);
+    ASSERT_EQ(queue->messages->Remove(ids(acked)), 3);
+    ASSERT_EQ(queue->messages->GetDurableCount(), 1);
+
+    // 覆盖已确认标签的区间只确认剩下的 4 与 8
+    acked.clear();
+    ASSERT_EQ(window.AckRange(1, 100, acked), 2);
+    ASSERT_EQ(acked[0].msg->payload().body(), "Hello World-3");
+    ASSERT_EQ(acked[1].msg->payload().body(), "Durable-2");
+    ASSERT_EQ(queue->messages->Remove(ids(acked)), 2);
+
+    ASSERT_EQ(window.Unacked(), 0);
+    ASSERT_EQ(queue->messages->GetWaitackCount(), 0);
+    ASSERT_EQ(queue->messages->GetDurableCount(), 0);
+    ASSERT_EQ(queue->messages->GetValidCount(), 0);
+}
+
+TEST_F(DeliveryTest, requeue)
+{
+    for(uint64_t i = 1; i <= 5; ++i)
+        deliverOne();
+    Delivery d;
+    ASSERT_EQ(window.Ack(2, d), true);
+    queue->messages->Remove(d.id);
+
+    // 未确认的 4 条按原顺序回到队头，排在未投递的消息之前
+    queue->messages->Insert(nullptr, "Later", false);
+    std::vector<Delivery> unacked;
+    ASSERT_EQ(window.TakeAll(unacked), 4);
+    ASSERT_EQ(window.Unacked(), 0);
+    std::vector<MessageId> ids;
+    for(auto& it : unacked) ids.push_back(it.id);
+    ASSERT_EQ(queue->messages->Requeue(ids), 4);
+    ASSERT_EQ(queue->messages->GetWaitackCount(), 0);
+    ASSERT_EQ(queue->messages->GetTableCount(), 5);
+
+    for(int i : {0, 2, 3, 4})
+        ASSERT_EQ(queue->messages->Front()->payload().body(), "Hello World-" + std::to_string(i));
+    ASSERT_EQ(queue->messages->Front()->payload().body(), "Later");
+
+    // 取出后窗口关闭，信道关闭期间的投递被拒绝，由调用者退回队列
+    ASSERT_EQ(window.Closed(), true);
+    queue->messages->Insert(nullptr, "Next", false);
+    MessageId id;
+    auto msg = queue->messages->Front(&id);
+    ASSERT_EQ(window.Push(queue, msg, id), 0);
+    ASSERT_EQ(queue->messages->Requeue({id}), 1);
+    ASSERT_EQ(queue->messages->Front()->payload().body(), "Next");
+}
+
+TEST_F(DeliveryTest, handoff)
+{
+    // 队列中还有待投递的消息时不能直通，避免越过它们
+    MessageId id;
+    ASSERT_EQ(queue->messages->InsertUnacked(nullptr, "Direct", id), nullptr);
+    while(queue->messages->Front())   ;
+
+    // 直通的消息只进入待确认表，确认后删除
+    auto msg = queue->messages->InsertUnacked(nullptr, "Direct", id);
+    ASSERT_NE(msg, nullptr);
+    ASSERT_EQ(queue->messages->GetTableCount(), 0);
+    ASSERT_EQ(queue->messages->GetWaitackCount(), 6);
+    uint64_t tag = window.Push(queue, msg, id);
+    Delivery d;
+    ASSERT_EQ(window.Ack(tag, d), true);
+    ASSERT_EQ(queue->messages->Remove(d.id), true);
+
+    // 持久化消息必须落盘，不走直通
+    BasicProperties bp;
+    bp.set_id(MessageId::Generate().ToString());
+    bp.set_delivery_mode(DeliveryMode::DURABLE);
+    ASSERT_EQ(queue->messages->InsertUnacked(&bp, "Durable", id), nullptr);
+    ASSERT_EQ(queue->messages->GetWaitackCount(), 5);
+}
+
+int main()
+{
+    testing::InitGoogleTest();
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,80 @@
+#include "executor.hpp"
+#include <gtest/gtest.h>
+#include <atomic>
+
+using namespace MyMQ;
+
+TEST(ShardedExecutor, order)
+{
+    const size_t keys = 8, per_key = 2000;
+    std::vector<std::vector<size_t>> seen(keys);
+    std::atomic<size_t> total{0};
+    {
+        ShardedExecutor executor(3);
+        // 同一键上的任务在同一分片上按提交顺序执行，无需加锁
+        for(size_t i = 0; i < per_key; ++i)
+        {
+            for(size_t k = 0; k < keys; ++k)
+            {
+                executor.Submit(k, [&seen, &total, k, i] {
+                    seen[k].push_back(i);
+                    ++total;
+                });
+            }
+        }
+    }   // 析构时执行完已提交的任务
+
+    ASSERT_EQ(total.load(), keys * per_key);
+    for(auto& v : seen)
+    {
+        ASSERT_EQ(v.size(), per_key);
+        for(size_t i = 0; i < per_key; ++i)
+            ASSERT_EQ(v[i], i);
+    }
+}
+
+TEST(Strand, serial)
+{
+    ThreadPool* pool = ThreadPool::getInstance(4);
+    const size_t strands = 6, per_strand = 1000;
+
+    struct State
+    {
+        StrandPtr strand = std::make_shared<Strand>();
+        std::vector<size_t> seen;
+        std::atomic<int> running{0};
+        bool overlapped = false;
+    };
+    std::vector<State> states(strands);
+    std::atomic<size_t> total{0};
+
+    for(size_t i = 0; i < per_strand; ++i)
+    {
+        for(auto& st : states)
+        {
+            st.strand->Post(pool, [&st, &total, i] {
+                // 同一 strand 的任务不会并发执行
+                if(st.running.fetch_add(1) != 0)   st.overlapped = true;
+                st.seen.push_back(i);
+                st.running.fetch_sub(1);
+                ++total;
+            });
+        }
+    }
+    while(total.load() < strands * per_strand)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    for(auto& st : states)
+    {
+        ASSERT_EQ(st.overlapped, false);
+        ASSERT_EQ(st.seen.size(), per_strand);
+        for(size_t i = 0; i < per_strand; ++i)
+            ASSERT_EQ(st.seen[i], i);
+    }
+}
+
+int main()
+{
+    testing::InitGoogleTest();
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,116 @@
+#include "message.hpp"
+#include <gtest/gtest.h>
+#include <thread>
+
+using namespace MyMQ;
+
+TEST(FlowControl, watermark)
+{
+    FlowOptions options;
+    options.memory_high = 1000;
+    options.memory_low = 500;
+    options.queue_high = 600;
+    auto flow = std::make_shared<FlowControl>(options);
+
+    std::vector<std::pair<bool, std::string>> events;
+    flow->SetCallback([&events](bool blocked, const std::string& reason) {
+        events.emplace_back(blocked, reason);
+    });
+
+    MessageManager mmp("./data/flow/", flow);
+    mmp.InitQueueManager("queue1");
+    mmp.InitQueueManager("queue2");
+    std::string body(100, 'x');
+
+    // 单个队列超过队列水位
+    for(int i = 0; i < 6; ++i)
+        mmp.Insert("queue1", nullptr, body, false);
+    ASSERT_EQ(flow->Used(), 600);
+    ASSERT_EQ(flow->Blocked(), true);
+    ASSERT_EQ(events.size(), 1);
+    ASSERT_EQ(events.back().second, "queue:queue1");
+
+    // 回落到队列水位的 3/4 以下才解除
+    auto q1 = mmp.GetQueueMessage("queue1");
+    for(int i = 0; i < 2; ++i)
+    {
+        auto msg = q1->Front();
+        q1->Remove(msg->payload().properties().id());
+    }
+    ASSERT_EQ(flow->Blocked(), false);
+    ASSERT_EQ(events.size(), 2);
+
+    // 全局内存超过高水位，低于低水位才解除
+    for(int i = 0; i < 6; ++i)
+        mmp.Insert("queue2", nullptr, body, false);
+    ASSERT_EQ(flow->Used(), 1000);
+    ASSERT_EQ(flow->Blocked(), true);
+    auto q2 = mmp.GetQueueMessage("queue2");
+    for(int i = 0; i < 4; ++i)
+    {
+        auto msg = q2->Front();
+        q2->Remove(msg->payload().properties().id());
+    }
+    ASSERT_EQ(flow->Used(), 600);
+    ASSERT_EQ(flow->Blocked(), true);
+    mmp.Clear();
+    ASSERT_EQ(flow->Used(), 0);
+    ASSERT_EQ(flow->Blocked(), false);
+
+    // 套接字告警
+    flow->Alarm("socket:127.0.0.1:5000", true);
+    ASSERT_EQ(flow->Blocked(), true);
+    flow->Alarm("socket:127.0.0.1:5000", false);
+    ASSERT_EQ(flow->Blocked(), false);
+}
+
+TEST(FlowControl, reentrantCallback)
+{
+    auto flow = std::make_shared<FlowControl>();
+    std::mutex manager;     // 模拟连接管理器的锁
+    std::vector<bool> events;
+    bool last = false;
+    // 回调持有管理器锁并再次调用流控对象，与 SetBlocked -> 连接析构 -> Alarm 的路径相同
+    flow->SetCallback([&](bool blocked, const std::string&) {
+        std::unique_lock<std::mutex> lock(manager);
+        events.push_back(blocked);
+        last = blocked;
+        if(!blocked)    flow->Alarm("socket:closing", false);
+        ASSERT_EQ(flow->Reason().empty(), !flow->Blocked());
+    });
+
+    flow->Alarm("socket:closing", true);
+    flow->Alarm("socket:closing", false);
+    ASSERT_EQ(events.size(), 2);
+
+    // 其他线程持有管理器锁时触发告警，不会与回调形成锁序反转
+    std::vector<std::thread> threads;
+    for(int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&flow, &manager, t] {
+            std::string source = "queue:q" + std::to_string(t);
+            for(int i = 0; i < 500; ++i)
+            {
+                if(i % 2 == 0)
+                {
+                    std::unique_lock<std::mutex> lock(manager);
+                    flow->Blocked();
+                }
+                flow->Alarm(source, i % 2 == 0);
+            }
+        });
+    }
+    for(auto& th : threads)
+        th.join();
+
+    // 最后一次通知与最终状态一致
+    ASSERT_EQ(flow->Blocked(), false);
+    std::unique_lock<std::mutex> lock(manager);
+    ASSERT_EQ(last, false);
+}
+
+int main()
+{
+    testing::InitGoogleTest();
+    return RUN_ALL_TESTS();
+}
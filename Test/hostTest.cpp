@@ -113,6 +113,79 @@ TEST_F(VirtualHostTest, AckTest)
     _host->BasicAck("queue1", msg3->payload().properties().id());
 }
 
+TEST_F(VirtualHostTest, QueueHandle)
+{
+    auto exp = _host->SelectExchange("exchange1");
+    auto targets = _host->Route(exp, std::string("news.music.#"));
+    ASSERT_EQ(targets->size(), 3);
+    for(auto& bp : *targets)
+    {
+        ASSERT_NE(bp->queue.get(), nullptr);
+        ASSERT_EQ(bp->queue, _host->SelectQueueHandle(bp->msgqueue_name));
+    }
+
+    auto queue = _host->SelectQueueHandle("queue1");
+    ASSERT_EQ(_host->BasicPublish(queue, nullptr, "Hello-World4"), true);
+    ASSERT_EQ(queue->messages->Front()->payload().body(), std::string("Hello-World1"));
+
+    // 重启后恢复的绑定同样持有句柄
+    {
+        VirtualHost recovered("host1", "./data/host1/message/", "./data/host1/host1.db");
+        auto rtargets = recovered.Route(recovered.SelectExchange("exchange1"), std::string("news.music.#"));
+        ASSERT_EQ(rtargets->size(), 3);
+        for(auto& bp : *rtargets)
+            ASSERT_EQ(bp->queue, recovered.SelectQueueHandle(bp->msgqueue_name));
+    }
+
+    _host->DeleteQueue("queue1");
+    ASSERT_EQ(_host->SelectQueueHandle("queue1").get(), nullptr);
+    ASSERT_EQ(_host->BasicPublish(queue, nullptr, "Hello-World5"), false);
+}
+
+TEST_F(VirtualHostTest, DeclareTopology)
+{
+    DeclareTopologyRequest req;
+    auto ex = req.add_exchanges();
+    ex->set_exchange_name("exchange4");
+    ex->set_exchange_type(ExchangeType::TOPIC);
+    ex->set_durable(true);
+    auto q = req.add_queues();
+    q->set_queue_name("queue4");
+    q->set_durable(true);
+    auto b = req.add_bindings();
+    b->set_exchange_name("exchange4");
+    b->set_queue_name("queue4");
+    b->set_binding_key("news.#");
+
+    ASSERT_EQ(_host->DeclareTopology(req), true);
+    ASSERT_EQ(_host->ExistExchange("exchange4"), true);
+    ASSERT_EQ(_host->ExistQueue("queue4"), true);
+    ASSERT_EQ(_host->ExistBinding("exchange4", "queue4"), true);
+
+    // 绑定引用了不存在的队列，整个请求回滚
+    DeclareTopologyRequest bad;
+    auto bex = bad.add_exchanges();
+    bex->set_exchange_name("exchange5");
+    bex->set_durable(true);
+    auto bq = bad.add_queues();
+    bq->set_queue_name("queue5");
+    bq->set_durable(true);
+    auto bb = bad.add_bindings();
+    bb->set_exchange_name("exchange5");
+    bb->set_queue_name("nosuchqueue");
+    ASSERT_EQ(_host->DeclareTopology(bad), false);
+    ASSERT_EQ(_host->ExistExchange("exchange5"), false);
+    ASSERT_EQ(_host->ExistQueue("queue5"), false);
+
+    // 持久化数据只由事务回滚撤销：重新加载后已提交的声明仍在，失败的声明不留痕迹
+    auto reloaded = std::make_shared<VirtualHost>("host1", "./data/host1/message/", "./data/host1/host1.db");
+    ASSERT_EQ(reloaded->ExistExchange("exchange4"), true);
+    ASSERT_EQ(reloaded->ExistQueue("queue4"), true);
+    ASSERT_EQ(reloaded->ExistBinding("exchange4", "queue4"), true);
+    ASSERT_EQ(reloaded->ExistExchange("exchange5"), false);
+    ASSERT_EQ(reloaded->ExistQueue("queue5"), false);
+}
+
 int main()
 {
     testing::InitGoogleTest();
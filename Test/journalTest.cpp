@@ -0,0 +1,113 @@
+#include "journal.hpp"
+#include <gtest/gtest.h>
+
+using namespace MyMQ;
+
+#define JOURNAL_DB "./data/journal/meta.db"
+
+class JournalTest : public testing::Test
+{
+public:
+    void SetUp() override
+    {
+        FileHelper::RemoveDirectory("./data/journal");
+    }
+
+    void TearDown() override
+    {
+        FileHelper::RemoveDirectory("./data/journal");
+    }
+
+    google::protobuf::Map<std::string, std::string> empty;
+};
+
+TEST_F(JournalTest, replay)
+{
+    {
+        JournalMetaStore store(JOURNAL_DB);
+        store.InsertExchange(std::make_shared<Exchange>("exchange1", ExchangeType::TOPIC, true, false, empty));
+        store.InsertExchange(std::make_shared<Exchange>("exchange2", ExchangeType::DIRECT, true, false, empty));
+        store.InsertQueue(std::make_shared<MsgQueue>("queue1", true, false, false, empty));
+        store.InsertBinding(std::make_shared<Binding>("exchange1", "queue1", "news.#"));
+        store.InsertBinding(std::make_shared<Binding>("exchange2", "queue1", "news"));
+        store.RemoveExchange("exchange2");
+        store.RemoveExchangeBindings("exchange2");
+    }
+
+    JournalMetaStore store(JOURNAL_DB);
+    auto exchanges = store.RecoveryExchanges();
+    ASSERT_EQ(exchanges.size(), 1);
+    ASSERT_EQ(exchanges["exchange1"]->type, ExchangeType::TOPIC);
+    ASSERT_EQ(store.RecoveryQueues().size(), 1);
+
+    auto bindings = store.RecoveryBindings();
+    ASSERT_EQ(bindings.size(), 1);
+    ASSERT_EQ(bindings["exchange1"]["queue1"]->binding_key, "news.#");
+}
+
+TEST_F(JournalTest, transaction)
+{
+    {
+        JournalMetaStore store(JOURNAL_DB);
+        store.Begin();
+        store.InsertQueue(std::make_shared<MsgQueue>("queue1", true, false, false, empty));
+        store.Rollback();
+
+        store.Begin();
+        store.InsertQueue(std::make_shared<MsgQueue>("queue2", true, false, false, empty));
+        store.Commit();
+    }
+
+    JournalMetaStore store(JOURNAL_DB);
+    auto queues = store.RecoveryQueues();
+    ASSERT_EQ(queues.size(), 1);
+    ASSERT_EQ(queues.count("queue2"), 1);
+}
+
+TEST_F(JournalTest, snapshot)
+{
+    {
+        JournalMetaStore store(JOURNAL_DB, 16);
+        for(int i = 0; i < 100; ++i)
+            store.InsertQueue(std::make_shared<MsgQueue>("queue" + std::to_string(i), true, false, false, empty));
+        for(int i = 0; i < 50; ++i)
+            store.RemoveQueue("queue" + std::to_string(i));
+    }
+
+    ASSERT_EQ(FileHelper("./data/journal/meta" SNAPSHOT_SUBFIX).Exists(), true);
+    ASSERT_LT(FileHelper("./data/journal/meta" JOURNAL_SUBFIX).Size(), 1024);
+
+    JournalMetaStore store(JOURNAL_DB, 16);
+    auto queues = store.RecoveryQueues();
+    ASSERT_EQ(queues.size(), 50);
+    ASSERT_EQ(queues.count("queue49"), 0);
+    ASSERT_EQ(queues.count("queue50"), 1);
+}
+
+TEST_F(JournalTest, tornTail)
+{
+    {
+        JournalMetaStore store(JOURNAL_DB);
+        store.InsertQueue(std::make_shared<MsgQueue>("queue1", true, false, false, empty));
+    }
+    // 模拟写到一半崩溃
+    std::string logfile = "./data/journal/meta" JOURNAL_SUBFIX;
+    size_t size = FileHelper(logfile).Size();
+    FileHelper(logfile).Write("\x30\x00\x00\x00garbage", size, 11);
+
+    {
+        JournalMetaStore store(JOURNAL_DB);
+        ASSERT_EQ(store.RecoveryQueues().size(), 1);
+        ASSERT_EQ(FileHelper(logfile).Size(), size);
+        store.InsertQueue(std::make_shared<MsgQueue>("queue2", true, false, false, empty));
+    }
+
+    JournalMetaStore store(JOURNAL_DB);
+    ASSERT_EQ(store.RecoveryQueues().size(), 2);
+}
+
+int main()
+{
+    testing::InitGoogleTest();
+    return RUN_ALL_TESTS();
+}
@@ -1,5 +1,7 @@
 #include "message.hpp"
 #include <gtest/gtest.h>
+#include <thread>
+#include <unordered_set>
 
 using namespace MyMQ;
 
@@ -21,6 +23,28 @@ public:
     }
 };
 
+TEST(MessageId, format)
+{
+    auto id = MessageId::Generate();
+    auto str = id.ToString();
+    ASSERT_EQ(str.size(), 36);
+    ASSERT_EQ(MessageId::FromString(str), id);
+    ASSERT_NE(MessageId::Generate(), id);
+
+    // 非本格式的 ID 按哈希映射，同一字符串结果稳定
+    ASSERT_EQ(MessageId::FromString("client-msg-1"), MessageId::FromString("client-msg-1"));
+    ASSERT_NE(MessageId::FromString("client-msg-1"), MessageId::FromString("client-msg-2"));
+
+    // 各线程生成的 ID 互不重复
+    std::vector<std::vector<MessageId>> ids(4);
+    std::vector<std::thread> threads;
+    for(auto& v : ids)
+        threads.emplace_back([&v] { for(int i = 0; i < 1000; ++i) v.push_back(MessageId::Generate()); });
+    for(auto& t : threads)  t.join();
+    std::unordered_set<MessageId, MessageIdHash> all;
+    for(auto& v : ids)  all.insert(v.begin(), v.end());
+    ASSERT_EQ(all.size(), 4000);
+}
 
 TEST(MessageManager, insert)
 {
@@ -101,6 +125,51 @@ TEST(MessageManager, deleteTest)
     ASSERT_EQ(mmp->GetTotalCount("queue1"), 4);
 }
 
+TEST(MessageManager, insertBatch)
+{
+    std::string basedir = "./data/message/";
+    auto qmp = std::make_shared<QueueMessage>(basedir, "queue3");
+    BasicProperties transient;
+    transient.set_id(UUIDHelper::UUID());
+    transient.set_delivery_mode(DeliveryMode::UNDURABLE);
+    std::vector<std::string> bodies = {"batch-1", "batch-2", "batch-3", "batch-4"};
+    std::vector<MessageRef> batch = {{nullptr, &bodies[0]}, {&transient, &bodies[1]},
+                                     {nullptr, &bodies[2]}, {nullptr, &bodies[3]}};
+    ASSERT_EQ(qmp->Insert(batch, true), 4);
+    ASSERT_EQ(qmp->GetTableCount(), 4);
+    ASSERT_EQ(qmp->GetDurableCount(), 3);
+    ASSERT_EQ(qmp->GetTotalCount(), 3);
+    for(auto& body : bodies)
+        ASSERT_EQ(qmp->Front()->payload().body(), body);
+
+    // 一次写入的持久化消息可以逐条恢复
+    QueueMessage reloaded(basedir, "queue3");
+    reloaded.Recovery();
+    ASSERT_EQ(reloaded.GetDurableCount(), 3);
+    qmp->Clear();
+}
+
+TEST(MessageManager, binaryId)
+{
+    std::string basedir = "./data/message/";
+    auto qmp = std::make_shared<QueueMessage>(basedir, "queue4");
+    qmp->Insert(nullptr, "transient-1", false);
+    qmp->Insert(nullptr, "transient-2", false);
+
+    // 非持久化消息在进程内只带二进制 ID，按 ID 取出时不格式化字符串
+    MessageId id;
+    auto msg = qmp->Front(&id);
+    ASSERT_EQ(msg->payload().properties().id().empty(), true);
+    ASSERT_EQ(qmp->Remove(id), true);
+
+    // 不取二进制 ID 的调用者按字符串确认，此时补上字符串形式
+    auto legacy = qmp->Front();
+    ASSERT_EQ(legacy->payload().properties().id().size(), 36);
+    ASSERT_EQ(qmp->Remove(legacy->payload().properties().id()), true);
+    ASSERT_EQ(qmp->GetWaitackCount(), 0);
+    qmp->Clear();
+}
+
 TEST(MessageManager, Destory)
 {
     mmp->DestroyQueueMessage("queue1");
@@ -0,0 +1,213 @@
+//
+// 路由基准：生成 100 ~ 100k 个绑定，分别用逐个绑定比较（Router::Route）
+// 与按交换机类型建立的路由表（BindingManager::Route）路由同一批消息，
+// 每个组合输出一行 JSON：吞吐（msgs/s）与每条消息的堆分配次数。
+//
+// 用法: routeBench [最大绑定数=100000] [每组时长ms=500]
+//
+
+#include "binding.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+using namespace MyMQ;
+
+// 统计堆分配次数
+static std::atomic<uint64_t> g_allocs{0};
+
+void* operator new(size_t size)
+{
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    if(void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+// 基准只关心内存中的路由表，不落盘
+class NullMetaStore : public MetaStore
+{
+public:
+    bool Begin() override { return true; }
+    bool Commit() override { return true; }
+    bool Rollback() override { return true; }
+
+    bool InsertExchange(const ExchangePtr&) override { return true; }
+    void RemoveExchange(const std::string&) override {}
+    ExchangeMap RecoveryExchanges() override { return {}; }
+    void ClearExchanges() override {}
+
+    bool InsertQueue(const MsgQueuePtr&) override { return true; }
+    void RemoveQueue(const std::string&) override {}
+    QueueMap RecoveryQueues() override { return {}; }
+    void ClearQueues() override {}
+
+    bool InsertBinding(const BindingPtr&) override { return true; }
+    void RemoveBinding(const std::string&, const std::string&) override {}
+    void RemoveExchangeBindings(const std::string&) override {}
+    void RemoveMsgQueueBindings(const std::string&) override {}
+    BindingMap RecoveryBindings() override { return {}; }
+    void ClearBindings() override {}
+};
+
+// 主题键：3~4 级，每级从有限词表取词，分布偏向少数热门词
+class KeyGenerator
+{
+public:
+    explicit KeyGenerator(uint64_t seed) :_rng(seed) {}
+
+    std::string Word(int level)
+    {
+        // 约一半落在前 8 个词上
+        size_t n = (_rng() % 2) ? _rng() % 8 : _rng() % 64;
+        return "l" + std::to_string(level) + "w" + std::to_string(n);
+    }
+
+    std::string RoutingKey()
+    {
+        int levels = 3 + _rng() % 2;
+        std::string key;
+        for(int i = 0; i < levels; ++i)
+        {
+            if(i) key += '.';
+            key += Word(i);
+        }
+        return key;
+    }
+
+    // 约 60% 精确，25% 含 '*'，15% 含 '#'
+    std::string BindingKey()
+    {
+        int levels = 3 + _rng() % 2;
+        int kind = _rng() % 100;
+        int pos = _rng() % levels;
+        std::string key;
+        for(int i = 0; i < levels; ++i)
+        {
+            if(i) key += '.';
+            if(kind >= 60 && kind < 85 && i == pos)
+                key += '*';
+            else if(kind >= 85 && i == pos)
+            {
+                key += '#';
+                break;
+            }
+            else
+                key += Word(i);
+        }
+        return key;
+    }
+
+private:
+    std::mt19937_64 _rng;
+};
+
+struct Result
+{
+    uint64_t msgs = 0;
+    uint64_t allocs = 0;
+    uint64_t matches = 0;
+    double seconds = 0;
+};
+
+// 反复路由 keys 直到超过时长
+template<typename Fn>
+Result Run(const std::vector<std::string>& keys, int duration_ms, Fn&& route)
+{
+    using Clock = std::chrono::steady_clock;
+    Result r;
+    auto deadline = Clock::now() + std::chrono::milliseconds(duration_ms);
+    uint64_t allocs = g_allocs.load();
+    auto start = Clock::now();
+    do
+    {
+        for(size_t i = 0; i < keys.size(); ++i)
+        {
+            r.matches += route(keys[i]);
+            ++r.msgs;
+            if((i & 63) == 63 && Clock::now() >= deadline) break;
+        }
+    } while(Clock::now() < deadline);
+    r.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    r.allocs = g_allocs.load() - allocs;
+    return r;
+}
+
+void Report(const char* type, const char* engine, size_t bindings, const Result& r)
+{
+    printf("{\"type\":\"%s\",\"engine\":\"%s\",\"bindings\":%zu,\"msgs\":%lu,"
+           "\"msgs_per_sec\":%.1f,\"allocs_per_op\":%.3f,\"matches_per_op\":%.3f}\n",
+           type, engine, bindings, (unsigned long)r.msgs,
+           r.msgs / r.seconds, (double)r.allocs / r.msgs, (double)r.matches / r.msgs);
+    fflush(stdout);
+}
+
+void Bench(ExchangeType type, const char* tname, size_t n, int duration_ms)
+{
+    KeyGenerator gen(n * 31 + type);
+
+    std::vector<BindingPtr> bindings;
+    auto bmp = std::make_shared<BindingManager>(std::make_shared<NullMetaStore>());
+    bmp->DeclareExchange("bench", type);
+    for(size_t i = 0; i < n; ++i)
+    {
+        std::string key = type == ExchangeType::TOPIC ? gen.BindingKey() : gen.RoutingKey();
+        std::string qname = "queue" + std::to_string(i);
+        bmp->Bind("bench", qname, key, false);
+        bindings.push_back(bmp->GetBinding("bench", qname));
+    }
+
+    std::vector<std::string> keys;
+    for(int i = 0; i < 4096; ++i)
+        keys.push_back(gen.RoutingKey());
+
+    // 基线：对每个绑定执行一次匹配
+    auto dp = Run(keys, duration_ms, [&](const std::string& key) {
+        size_t matched = 0;
+        for(auto& bp : bindings)
+        {
+            if(Router::Route(type, key, bp->binding_key))
+                ++matched;
+        }
+        return matched;
+    });
+    Report(tname, "dp", n, dp);
+
+    auto table = Run(keys, duration_ms, [&](const std::string& key) {
+        return bmp->Route("bench", type, key)->size();
+    });
+    Report(tname, "table", n, table);
+
+    if(type == ExchangeType::TOPIC)
+    {   // 不经过路由缓存，单看匹配树
+        auto eb = bmp->GetExchangeBindings("bench");
+        BindingList result;
+        auto trie = Run(keys, duration_ms, [&](const std::string& key) {
+            result.clear();
+            eb->topic.Match(key, result);
+            return result.size();
+        });
+        Report(tname, "trie", n, trie);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    size_t max_bindings = argc > 1 ? std::stoul(argv[1]) : 100000;
+    int duration_ms = argc > 2 ? std::stoi(argv[2]) : 500;
+
+    // 日志与结果都写 stdout，只保留告警以上
+    Log::getInstance().getLogger()->set_level(spdlog::level::warn);
+    for(size_t n = 100; n <= max_bindings; n *= 10)
+    {
+        Bench(ExchangeType::DIRECT, "DIRECT", n, duration_ms);
+        Bench(ExchangeType::FANOUT, "FANOUT", n, duration_ms);
+        Bench(ExchangeType::TOPIC, "TOPIC", n, duration_ms);
+    }
+    return 0;
+}
@@ -57,6 +57,59 @@ TEST(RouterTest, TopicExchange)
     ASSERT_EQ(Router::Route(ExchangeType::TOPIC, "aaa.ddd.ccc.bbb.eee.bbb", "aaa.#.bbb.*.bbb"), true);
 }
 
+TEST(RouterTest, Tokenize)
+{
+    for(std::string key : {"", ".", "aaa", "aaa.bbb.ccc", "aaa..bbb.", "a.b.c.d.e.f.g.h.i.j.k.l.m.n.o.p.q.r.s"})
+    {
+        std::vector<std::string> expect;
+        StrHelper::Split(expect, key, ".");
+
+        KeyTokens tokens;
+        StrHelper::Tokenize(tokens, key, '.');
+        ASSERT_EQ(std::vector<std::string>(tokens.begin(), tokens.end()), expect) << "key: " << key;
+    }
+}
+
+TEST(RouterTest, TopicTrie)
+{
+    const std::vector<std::string> bindingKeys = {
+        "aaa", "aaa.bbb", "aaa.*.ccc", "aaa.#", "#.ccc", "#", "*", "*.*",
+        "aaa.#.ccc.ccc", "aaa.#.bbb", "aaa.#.bbb.*.bbb", "#.#", "*.aaa.bbb.ccc", "news.music.#"
+    };
+    const std::vector<std::string> routingKeys = {
+        "aaa", "aaa.bbb", "aaa.bbb.ccc", "bbb.ccc", "ccc", "aaa.bbb.ccc.ccc.ccc",
+        "aaa.ccc", "aaa.aaa.bbb.ccc", "aaa.ddd.ccc.bbb.eee.bbb", "news.music.pop", "news", ""
+    };
+
+    TopicTrie<std::string> trie;
+    for(auto& key : bindingKeys)
+        trie = trie.Insert(key, key);
+
+    for(auto& rkey : routingKeys)
+    {
+        std::vector<std::string> result;
+        trie.Match(rkey, result);
+        std::sort(result.begin(), result.end());
+
+        std::vector<std::string> expect;
+        for(auto& bkey : bindingKeys)
+        {
+            if(Router::Route(ExchangeType::TOPIC, rkey, bkey))
+                expect.push_back(bkey);
+        }
+        std::sort(expect.begin(), expect.end());
+        ASSERT_EQ(result, expect) << "routing key: " << rkey;
+    }
+
+    // 删除后旧树不受影响
+    auto erased = trie.Erase("aaa.#", "aaa.#").Erase("#", "#").Erase("#.#", "#.#");
+    std::vector<std::string> before, after;
+    trie.Match("aaa.zzz", before);
+    erased.Match("aaa.zzz", after);
+    ASSERT_EQ(before.size(), 4);
+    ASSERT_EQ(after, std::vector<std::string>{"*.*"});
+}
+
 int main()
 {
     testing::InitGoogleTest();
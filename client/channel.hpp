@@ -11,8 +11,13 @@
 #include "help.hpp"
 #include "mqproto.pb.h"
 #include "log.hpp"
+#include <atomic>
 #include <memory>
 #include <condition_variable>
+#include <chrono>
+#include <future>
+#include <map>
+#include <unordered_set>
 #include <muduo/net/TcpConnection.h>
 
 
@@ -26,6 +31,10 @@ namespace MyMQ
     using ProtobufCodecPtr = std::shared_ptr<ProtobufCodec>;
     using BasicCommonResponsePtr = std::shared_ptr<BasicCommonResponse>;
     using BasicConsumeResponsePtr = std::shared_ptr<BasicConsumeResponse>;
+    using BasicConsumeBatchResponsePtr = std::shared_ptr<BasicConsumeBatchResponse>;
+    using BasicGetResponsePtr = std::shared_ptr<BasicGetResponse>;
+    using BasicConfirmResponsePtr = std::shared_ptr<BasicConfirmResponse>;
+    using ConfirmCallback = std::function<void(uint64_t seq, bool ok)>;
 
     class Channel
     {
@@ -37,6 +46,25 @@ namespace MyMQ
         std::mutex _mutex;
         std::condition_variable _cv;
         std::unordered_map<std::string, BasicCommonResponsePtr> _basicResps;
+        std::unordered_map<std::string, BasicGetResponsePtr> _getResps;
+        std::unordered_set<std::string> _abandonedGets;     // 已超时放弃的拉取请求，迟到的应答直接丢弃
+        std::mutex _tag_mutex;
+        std::unordered_map<std::string, uint64_t> _deliveryTags;   // 消息 ID -> 待确认的投递标签
+
+        // 发布确认模式
+        struct PendingConfirm {
+            std::promise<bool> promise;
+            ConfirmCallback callback;
+        };
+        std::mutex _confirm_mutex;
+        std::condition_variable _confirm_cv;
+        std::atomic<bool> _confirm{false};
+        uint64_t _publishSeq = 0;
+        std::map<uint64_t, PendingConfirm> _pending;    // 序号 -> 等待确认的发布
+        bool _nacked = false;       // 上次 WaitForConfirms 之后出现过失败的发布
+
+        // BasicGet 在请求的等待时间之外再等待应答的时长
+        static constexpr std::chrono::milliseconds GET_REPLY_MARGIN{5000};
 
     private:
         BasicCommonResponsePtr WaitResponse(const std::string& rid) {
@@ -129,13 +157,15 @@ namespace MyMQ
         }
 
 
-        bool QueueBind(const std::string& ename, const std::string& qname, const std::string& key) {
+        bool QueueBind(const std::string& ename, const std::string& qname, const std::string& key,
+                       const google::protobuf::Map<std::string, std::string>& args = {}) {
             QueueBindRequest req;
             req.set_cid(_cid);
             req.set_rid(UUIDHelper::UUID());
             req.set_exchange_name(ename);
             req.set_queue_name(qname);
             req.set_binding_key(key);
+            *req.mutable_args() = args;
             _codec->send(_conn, req);
             auto resq = WaitResponse(req.rid());
             return resq->ok();
@@ -152,27 +182,126 @@ namespace MyMQ
             WaitResponse(req.rid());
         }
 
+        // 批量声明：调用方填充 exchanges/queues/bindings，一次往返完成
+        bool DeclareTopology(DeclareTopologyRequest& req) {
+            req.set_cid(_cid);
+            req.set_rid(UUIDHelper::UUID());
+            _codec->send(_conn, req);
+            auto resq = WaitResponse(req.rid());
+            return resq->ok();
+        }
+
         void BasicPublish(const std::string& ename, const BasicProperties* bp, const std::string& body) {
+            if(_confirm.load(std::memory_order_acquire)) {
+                BasicPublishAsync(ename, bp, body).wait();
+                return;
+            }
             BasicPublishRequest req;
+            buildPublish(req, ename, bp, body);
+            _codec->send(_conn, req);
+            WaitResponse(req.rid());
+        }
+
+        // 开启发布确认模式，之后的发布可以连续发送，由服务端异步确认
+        bool ConfirmSelect() {
+            ConfirmSelectRequest req;
             req.set_cid(_cid);
             req.set_rid(UUIDHelper::UUID());
-            req.set_exchange_name(ename);
-            req.set_body(body);
-            if(bp) {
-                auto props = req.mutable_properties();
-                props->set_id(bp->id());
-                props->set_delivery_mode(bp->delivery_mode());
-                props->set_routing_key(bp->routing_key());
+            _codec->send(_conn, req);
+            auto resq = WaitResponse(req.rid());
+            if(resq->ok())
+                _confirm.store(true, std::memory_order_release);
+            return resq->ok();
+        }
+
+        // 确认模式下不等待应答直接返回，结果通过 future 与回调（在网络线程中执行）给出；
+        // 未开启确认模式时退化为同步发布
+        std::future<bool> BasicPublishAsync(const std::string& ename, const BasicProperties* bp,
+                const std::string& body, const ConfirmCallback& cb = {}) {
+            if(!_confirm.load(std::memory_order_acquire)) {
+                BasicPublish(ename, bp, body);
+                std::promise<bool> done;
+                done.set_value(true);
+                return done.get_future();
+            }
+            BasicPublishRequest req;
+            buildPublish(req, ename, bp, body);
+            std::future<bool> result;
+            {
+                std::unique_lock<std::mutex> lock(_confirm_mutex);
+                uint64_t seq = ++_publishSeq;
+                auto& pending = _pending[seq];
+                pending.callback = cb;
+                result = pending.promise.get_future();
+                req.set_publish_seq(seq);
             }
             _codec->send(_conn, req);
-            WaitResponse(req.rid());
+            return result;
         }
 
+        // 等待此前所有发布得到确认；超时或期间有发布失败返回 false
+        bool WaitForConfirms(std::chrono::milliseconds timeout) {
+            std::unique_lock<std::mutex> lock(_confirm_mutex);
+            if(!_confirm_cv.wait_for(lock, timeout, [this] { return _pending.empty(); }))
+                return false;
+            bool ok = !_nacked;
+            _nacked = false;
+            return ok;
+        }
+
+        // 批量发布：一个请求携带多条消息，只等待一次应答
+        bool BasicPublishBatch(BasicPublishBatchRequest& req) {
+            if(_confirm.load(std::memory_order_acquire))
+                return BasicPublishBatchAsync(req).get();
+            req.set_cid(_cid);
+            req.set_rid(UUIDHelper::UUID());
+            _codec->send(_conn, req);
+            auto resq = WaitResponse(req.rid());
+            return resq->ok();
+        }
+
+        // 确认模式下的批量发布，不等待确认直接返回，可与 WaitForConfirms 配合使用。
+        // 整批占用一段连续序号，服务端对最后一个序号做累计确认：确认针对整批，
+        // 任一条入队失败整批即为失败，回调只以最后一个序号调用一次。未开启确认模式时退化为同步发布
+        std::future<bool> BasicPublishBatchAsync(BasicPublishBatchRequest& req, const ConfirmCallback& cb = {}) {
+            if(!_confirm.load(std::memory_order_acquire) || req.entries_size() == 0) {
+                std::promise<bool> done;
+                done.set_value(req.entries_size() == 0 || BasicPublishBatch(req));
+                return done.get_future();
+            }
+            req.set_cid(_cid);
+            req.set_rid(UUIDHelper::UUID());
+            std::future<bool> result;
+            {
+                std::unique_lock<std::mutex> lock(_confirm_mutex);
+                req.set_publish_seq(_publishSeq + 1);
+                _publishSeq += req.entries_size();
+                auto& pending = _pending[_publishSeq];
+                pending.callback = cb;
+                result = pending.promise.get_future();
+            }
+            _codec->send(_conn, req);
+            return result;
+        }
+
+        // 按消息 ID 确认；该消息带有投递标签时改用标签
         void BasicAck(const std::string& msgid) {
             if (!_consumer) {
                 LOG_DEBUG("无消费者");
                 return;
             }
+            uint64_t tag = 0;
+            {
+                std::unique_lock<std::mutex> lock(_tag_mutex);
+                auto it = _deliveryTags.find(msgid);
+                if(it != _deliveryTags.end()) {
+                    tag = it->second;
+                    _deliveryTags.erase(it);
+                }
+            }
+            if(tag != 0)
+                return BasicAck(tag);
+
             BasicAckRequest req;
             req.set_cid(_cid);
             req.set_rid(UUIDHelper::UUID());
@@ -183,8 +312,106 @@ namespace MyMQ
              WaitResponse(req.rid());
         }
 
+        // multiple 为 true 时确认该标签及之前的全部投递；wait 为 false 时不等待应答
+        void BasicAck(uint64_t deliveryTag, bool multiple = false, bool wait = true) {
+            BasicAckRequest req;
+            req.set_cid(_cid);
+            req.set_rid(UUIDHelper::UUID());
+            req.set_delivery_tag(deliveryTag);
+            req.set_multiple(multiple);
+            req.set_no_wait(!wait);
+            if(multiple) {
+                forgetTags([deliveryTag](uint64_t tag) { return tag <= deliveryTag; });
+            } else {
+                forgetTags([deliveryTag](uint64_t tag) { return tag == deliveryTag; });
+            }
+
+            _codec->send(_conn, req);
+            if(wait) WaitResponse(req.rid());
+        }
+
+        // 批量确认：连续的标签合并为区间，一个请求发出
+        void BasicAck(std::vector<uint64_t> deliveryTags, bool wait = true) {
+            if(deliveryTags.empty()) return;
+            std::sort(deliveryTags.begin(), deliveryTags.end());
+
+            BasicAckRequest req;
+            req.set_cid(_cid);
+            req.set_rid(UUIDHelper::UUID());
+            req.set_no_wait(!wait);
+            DeliveryTagRange* range = nullptr;
+            for(uint64_t tag : deliveryTags) {
+                if(range && tag <= range->last() + 1) {
+                    range->set_last(std::max(range->last(), tag));
+                    continue;
+                }
+                range = req.add_ranges();
+                range->set_first(tag);
+                range->set_last(tag);
+            }
+            forgetTags([&deliveryTags](uint64_t tag) {
+                return std::binary_search(deliveryTags.begin(), deliveryTags.end(), tag);
+            });
+
+            _codec->send(_conn, req);
+            if(wait) WaitResponse(req.rid());
+        }
+
+        // 预取限制：未确认的消息数/消息体字节数达到上限后服务端暂停投递，0 表示不限制
+        bool BasicQos(uint32_t prefetchCount, uint32_t prefetchSize = 0) {
+            BasicQosRequest req;
+            req.set_cid(_cid);
+            req.set_rid(UUIDHelper::UUID());
+            req.set_prefetch_count(prefetchCount);
+            req.set_prefetch_size(prefetchSize);
+            _codec->send(_conn, req);
+            auto resq = WaitResponse(req.rid());
+            return resq->ok();
+        }
+
+        // 拉取至多 maxMessages 条消息；队列为空时最多等待 timeoutMs 毫秒（0 不等待）。
+        // 返回的每条消息带有投递标签，非 noAck 时需要 BasicAck；队列不存在或等待应答超时时 ok() 为 false
+        BasicGetResponsePtr BasicGet(const std::string& qname, uint32_t maxMessages = 1, bool noAck = false,
+                uint32_t timeoutMs = 0) {
+            BasicGetRequest req;
+            req.set_cid(_cid);
+            req.set_rid(UUIDHelper::UUID());
+            req.set_queue_name(qname);
+            req.set_max_messages(maxMessages);
+            req.set_no_ack(noAck);
+            req.set_timeout_ms(timeoutMs);
+            _codec->send(_conn, req);
+
+            BasicGetResponsePtr resp;
+            {
+                // 应答丢失或连接断开时不会一直阻塞
+                auto deadline = std::chrono::milliseconds(timeoutMs) + GET_REPLY_MARGIN;
+                std::unique_lock<std::mutex> lock(_mutex);
+                if(!_cv.wait_for(lock, deadline, [&req, this] { return _getResps.contains(req.rid()); })) {
+                    LOG_DEBUG("拉取消息等待应答超时：{}", req.rid());
+                    _abandonedGets.insert(req.rid());
+                    resp = std::make_shared<BasicGetResponse>();
+                    resp->set_rid(req.rid());
+                    resp->set_cid(_cid);
+                    resp->set_ok(false);
+                    return resp;
+                }
+                resp = _getResps[req.rid()];
+                _getResps.erase(req.rid());
+            }
+            if(!noAck) {
+                std::unique_lock<std::mutex> lock(_tag_mutex);
+                for(auto& entry : resp->entries())
+                    _deliveryTags[entry.properties().id()] = entry.delivery_tag();
+            }
+            return resp;
+        }
+
+        // maxBatch > 1 时服务端可把多条消息合成一帧推送，maxBatchBytes 限制一帧的消息体字节数（0 不限制）；
+        // priority 为消费者优先级，队列使用 priority 策略时生效
         bool BasicConsume(const std::string& consumer_tag, const std::string& qname,
-                bool autoAck, const ConsumerCallback& cb) {
+                bool autoAck, const ConsumerCallback& cb, uint32_t maxBatch = 1, uint32_t maxBatchBytes = 0,
+                int32_t priority = 0) {
             if(_consumer.get()) {
                 LOG_DEBUG("当前信道已经订阅其他队列信息！");
                 return false;
@@ -195,6 +422,10 @@ namespace MyMQ
             req.set_consumer_tag(consumer_tag);
             req.set_auto_ack(autoAck);
             req.set_queue_name(qname);
+            req.set_max_batch(maxBatch);
+            req.set_max_batch_bytes(maxBatchBytes);
+            if(priority != 0)
+                (*req.mutable_args())["x-priority"] = std::to_string(priority);
             _codec->send(_conn, req);
             auto resp = WaitResponse(req.rid());
             if(!resp->ok()) {
@@ -218,6 +449,28 @@ namespace MyMQ
             WaitResponse(req.rid());
             _codec.reset();
         }
+    private:
+        void buildPublish(BasicPublishRequest& req, const std::string& ename, const BasicProperties* bp, const std::string& body) {
+            req.set_cid(_cid);
+            req.set_rid(UUIDHelper::UUID());
+            req.set_exchange_name(ename);
+            req.set_body(body);
+            if(bp) {
+                auto props = req.mutable_properties();
+                props->set_id(bp->id());
+                props->set_delivery_mode(bp->delivery_mode());
+                props->set_routing_key(bp->routing_key());
+                *props->mutable_headers() = bp->headers();
+            }
+        }
+
+        // 清理已确认标签对应的 消息 ID -> 标签 记录
+        template<typename Pred>
+        void forgetTags(Pred pred) {
+            std::unique_lock<std::mutex> lock(_tag_mutex);
+            std::erase_if(_deliveryTags, [&pred](const auto& it) { return pred(it.second); });
+        }
+
     public:
         void PutBasicResponse(const BasicCommonResponsePtr& resp) {
             std::unique_lock<std::mutex> lock(_mutex);
@@ -225,6 +478,33 @@ namespace MyMQ
             _cv.notify_all();
         }
 
+        void PutGetResponse(const BasicGetResponsePtr& resp) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            if(_abandonedGets.erase(resp->rid()) > 0)
+                return;
+            _getResps.insert(std::make_pair(resp->rid(), resp));
+            _cv.notify_all();
+        }
+
+        void Confirm(const BasicConfirmResponsePtr& resp) {
+            std::vector<std::pair<uint64_t, PendingConfirm>> done;
+            {
+                std::unique_lock<std::mutex> lock(_confirm_mutex);
+                auto first = resp->multiple() ? _pending.begin() : _pending.find(resp->seq());
+                auto last = _pending.upper_bound(resp->seq());
+                if(first == _pending.end()) return;
+                for(auto it = first; it != last; ++it)
+                    done.emplace_back(it->first, std::move(it->second));
+                _pending.erase(first, last);
+                if(!resp->ok()) _nacked = true;
+            }
+            for(auto& it : done) {
+                if(it.second.callback) it.second.callback(it.first, resp->ok());
+                it.second.promise.set_value(resp->ok());
+            }
+            _confirm_cv.notify_all();
+        }
+
        void Consume(const BasicConsumeResponsePtr& resq) {
             if(!_consumer.get()) {
                 LOG_DEBUG("信息处理时，未找到订阅者信息！");
@@ -234,8 +514,31 @@ namespace MyMQ
                 LOG_DEBUG("信息处理时，标签不一致");
                 return;
             }
+            if(resq->delivery_tag() != 0) {
+                std::unique_lock<std::mutex> lock(_tag_mutex);
+                _deliveryTags[resq->properties().id()] = resq->delivery_tag();
+            }
             _consumer->callback(resq->consumer_tag(), resq->mutable_properties(), resq->body());
         }
+
+        // 批量投递：按顺序逐条交给回调
+        void ConsumeBatch(const BasicConsumeBatchResponsePtr& resq) {
+            if(!_consumer.get()) {
+                LOG_DEBUG("信息处理时，未找到订阅者信息！");
+                return;
+            }
+            if(_consumer->tag != resq->consumer_tag()) {
+                LOG_DEBUG("信息处理时，标签不一致");
+                return;
+            }
+            if(!_consumer->autoAck) {
+                std::unique_lock<std::mutex> lock(_tag_mutex);
+                for(auto& entry : resq->entries())
+                    _deliveryTags[entry.properties().id()] = entry.delivery_tag();
+            }
+            for(auto& entry : *resq->mutable_entries())
+                _consumer->callback(resq->consumer_tag(), entry.mutable_properties(), entry.body());
+        }
     };
 
     class ChannelManager {
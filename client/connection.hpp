@@ -20,6 +20,10 @@ namespace MyMQ {
 
     using ConnectionPtr = std::shared_ptr<Connection>;
     using BasicConsumeRequestPtr = std::shared_ptr<BasicConsumeResponse>;
+    using ConnectionBlockedPtr = std::shared_ptr<ConnectionBlocked>;
+    using ConnectionUnblockedPtr = std::shared_ptr<ConnectionUnblocked>;
+    // 服务端流控通知：blocked 为 true 时 reason 为原因
+    using BlockedCallback = std::function<void(bool blocked, const std::string& reason)>;
     using namespace std::placeholders;
 
     class Connection {
@@ -31,6 +35,9 @@ namespace MyMQ {
         ProtobufDispatcher _dispatcher;
         ProtobufCodecPtr _codec;
         ChannelManagerPtr _cmp;
+        std::mutex _blocked_mutex;
+        bool _blocked = false;
+        BlockedCallback _blocked_cb;
 
     public:
         Connection(const std::string& ip, int port, const AsyncWorkerPtr& worker)
@@ -42,6 +49,11 @@ namespace MyMQ {
 
             _dispatcher.registerMessageCallback<BasicCommonResponse>(std::bind(&Connection::BasicResponse, this, _1, _2, _3));
             _dispatcher.registerMessageCallback<BasicConsumeResponse>(std::bind(&Connection::ConsumeResponse, this, _1, _2, _3));
+            _dispatcher.registerMessageCallback<BasicConsumeBatchResponse>(std::bind(&Connection::ConsumeBatchResponse, this, _1, _2, _3));
+            _dispatcher.registerMessageCallback<BasicGetResponse>(std::bind(&Connection::GetResponse, this, _1, _2, _3));
+            _dispatcher.registerMessageCallback<BasicConfirmResponse>(std::bind(&Connection::ConfirmResponse, this, _1, _2, _3));
+            _dispatcher.registerMessageCallback<ConnectionBlocked>(std::bind(&Connection::OnBlocked, this, _1, _2, _3));
+            _dispatcher.registerMessageCallback<ConnectionUnblocked>(std::bind(&Connection::OnUnblocked, this, _1, _2, _3));
 
             _client.setMessageCallback(std::bind(&ProtobufCodec::onMessage, _codec.get(), _1, _2, _3));
             _client.setConnectionCallback(std::bind(&Connection::OnConnection, this, _1));
@@ -62,6 +74,17 @@ namespace MyMQ {
             return channel;
         }
 
+        // 服务端暂停读取本连接期间，发布请求会在服务端积压，等待确认的调用随之阻塞
+        bool Blocked() {
+            std::unique_lock<std::mutex> lock(_blocked_mutex);
+            return _blocked;
+        }
+
+        void SetBlockedCallback(const BlockedCallback& cb) {
+            std::unique_lock<std::mutex> lock(_blocked_mutex);
+            _blocked_cb = cb;
+        }
+
         void CloseChannel(const ChannelPtr& ptr) {
             ptr->CloseChannel();
             _cmp->Remove(ptr->cid());
@@ -90,6 +113,55 @@ namespace MyMQ {
             });
         }
 
+        void ConsumeBatchResponse(const muduo::net::TcpConnectionPtr& conn, const BasicConsumeBatchResponsePtr& resp, muduo::Timestamp) {
+            auto channel = _cmp->Get(resp->cid());
+            if(!channel) {
+                LOG_DEBUG("信道未找到");
+                return;
+            }
+            _worker->_pool->enqueue([channel, resp] {
+                channel->ConsumeBatch(resp);
+            });
+        }
+
+        void GetResponse(const muduo::net::TcpConnectionPtr& conn, const BasicGetResponsePtr& resp, muduo::Timestamp) {
+            auto channel = _cmp->Get(resp->cid());
+            if(!channel) {
+                LOG_DEBUG("信道未找到");
+                return;
+            }
+            channel->PutGetResponse(resp);
+        }
+
+        void ConfirmResponse(const muduo::net::TcpConnectionPtr& conn, const BasicConfirmResponsePtr& resp, muduo::Timestamp) {
+            auto channel = _cmp->Get(resp->cid());
+            if(!channel) {
+                LOG_DEBUG("信道未找到");
+                return;
+            }
+            channel->Confirm(resp);
+        }
+
+        void OnBlocked(const muduo::net::TcpConnectionPtr& conn, const ConnectionBlockedPtr& msg, muduo::Timestamp) {
+            LOG_INFO("服务端流控，暂停发布：{}", msg->reason());
+            setBlocked(true, msg->reason());
+        }
+
+        void OnUnblocked(const muduo::net::TcpConnectionPtr& conn, const ConnectionUnblockedPtr&, muduo::Timestamp) {
+            LOG_INFO("服务端流控解除");
+            setBlocked(false, "");
+        }
+
+        void setBlocked(bool blocked, const std::string& reason) {
+            BlockedCallback cb;
+            {
+                std::unique_lock<std::mutex> lock(_blocked_mutex);
+                _blocked = blocked;
+                cb = _blocked_cb;
+            }
+            if(cb) cb(blocked, reason);
+        }
+
         void OnUnknownMessage(const muduo::net::TcpConnectionPtr& conn, const MessagePtr& req, muduo::Timestamp) {
             LOG_INFO("UnkownMessage from {}", conn->peerAddress().toIpPort());
         }
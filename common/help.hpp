@@ -6,10 +6,15 @@
 #include <boost/algorithm/string.hpp>
 #include <google/protobuf/map.h>
 #include <random>
+#include <atomic>
 #include <fstream>
 #include <iostream>
 #include <sys/stat.h>
 #include <sstream>
+#include <string_view>
+#include <array>
+#include <algorithm>
+#include <vector>
 #include <sys/types.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -50,6 +55,22 @@ namespace MyMQ
             return true;
         }
 
+        // 事务：同一连接上的多条语句只提交一次
+        bool Begin()
+        {
+            return Exec("begin transaction;", nullptr, nullptr);
+        }
+
+        bool Commit()
+        {
+            return Exec("commit;", nullptr, nullptr);
+        }
+
+        bool Rollback()
+        {
+            return Exec("rollback;", nullptr, nullptr);
+        }
+
         void Close()
         {
             if(_handler) sqlite3_close_v2(_handler);
@@ -65,9 +86,96 @@ namespace MyMQ
         sqlite3 *_handler;
     };
 
+    using SqliteHelperPtr = std::shared_ptr<SqliteHelper>;
+
+    // 前 N 个元素放在对象内部（通常即栈上），超出后才转到堆上
+    template<typename T, size_t N>
+    class SmallVector
+    {
+    public:
+        void push_back(const T& value)
+        {
+            if(!_heap.empty())
+            {
+                _heap.push_back(value);
+            }
+            else if(_size < N)
+            {
+                _inline[_size] = value;
+            }
+            else
+            {
+                _heap.reserve(N * 2);
+                _heap.assign(_inline.begin(), _inline.end());
+                _heap.push_back(value);
+            }
+            ++_size;
+        }
+
+        void assign(size_t n, const T& value)
+        {
+            clear();
+            if(n > N)
+            {
+                _heap.assign(n, value);
+            }
+            else
+            {
+                std::fill_n(_inline.begin(), n, value);
+            }
+            _size = n;
+        }
+
+        void clear()
+        {
+            _heap.clear();
+            _size = 0;
+        }
+
+        size_t size() const { return _size; }
+        bool empty() const { return _size == 0; }
+
+        T* data() { return _heap.empty() ? _inline.data() : _heap.data(); }
+        const T* data() const { return _heap.empty() ? _inline.data() : _heap.data(); }
+
+        T& operator[](size_t i) { return data()[i]; }
+        const T& operator[](size_t i) const { return data()[i]; }
+
+        T* begin() { return data(); }
+        T* end() { return data() + _size; }
+        const T* begin() const { return data(); }
+        const T* end() const { return data() + _size; }
+
+    private:
+        std::array<T, N> _inline{};
+        std::vector<T> _heap;
+        size_t _size = 0;
+    };
+
+    // 路由键/绑定键的单词切片，指向原字符串，原字符串须比它活得久
+    using KeyTokens = SmallVector<std::string_view, 16>;
+
     class StrHelper
     {
     public:
+        // 按单个分隔符切分，不分配内存；与 Split 一致保留空单词
+        static void Tokenize(KeyTokens& result, std::string_view str, char sep)
+        {
+            result.clear();
+            size_t idx = 0;
+            while(true)
+            {
+                size_t pos = str.find(sep, idx);
+                if(pos == std::string_view::npos)
+                {
+                    result.push_back(str.substr(idx));
+                    return;
+                }
+                result.push_back(str.substr(idx, pos - idx));
+                idx = pos + 1;
+            }
+        }
+
         static void Split(std::vector<std::string>& result, const std::string& str, const std::string& seq)
         {
             boost::split(result, str, boost::is_any_of(seq));
@@ -91,27 +199,108 @@ namespace MyMQ
         }
     };
 
+    // 128 位消息 ID，进程内以定长二进制保存，只在协议边界转成字符串。
+    // 高 64 位 = 进程随机前缀(48) | 线程序号(16)，低 64 位 = 线程内自增序号，
+    // 生成时只访问线程局部变量，无锁。
+    struct MessageId
+    {
+        uint64_t hi = 0;
+        uint64_t lo = 0;
+
+        bool operator==(const MessageId&) const = default;
+
+        static MessageId Generate()
+        {
+            thread_local uint64_t prefix = processPrefix() | (threadSeq().fetch_add(1, std::memory_order_relaxed) & 0xffff);
+            thread_local uint64_t seq = 0;
+            return MessageId{prefix, ++seq};
+        }
+
+        // 8-4-4-4-12 的十六进制格式
+        std::string ToString() const
+        {
+            static const char digits[] = "0123456789abcdef";
+            std::string result(36, '-');
+            size_t pos = 0;
+            for(int i = 0; i < 32; ++i)
+            {
+                if(pos == 8 || pos == 13 || pos == 18 || pos == 23) ++pos;
+                uint64_t word = i < 16 ? hi : lo;
+                result[pos++] = digits[(word >> ((15 - i % 16) * 4)) & 0xf];
+            }
+            return result;
+        }
+
+        // 能按 ToString 的格式解析则还原，否则对字符串做 128 位哈希，
+        // 使客户端自带的任意 ID 也能作为定长键使用
+        static MessageId FromString(std::string_view str)
+        {
+            MessageId id;
+            if(str.size() == 36 && parse(str, id))
+                return id;
+
+            uint64_t h1 = 14695981039346656037ULL, h2 = 0x9e3779b97f4a7c15ULL;
+            for(unsigned char ch : str)
+            {
+                h1 = (h1 ^ ch) * 1099511628211ULL;
+                h2 = (h2 ^ ch) * 0x100000001b3ULL + 0x7f4a7c15;
+            }
+            return MessageId{h1, h2};
+        }
+
+    private:
+        static bool parse(std::string_view str, MessageId& id)
+        {
+            int n = 0;
+            for(size_t pos = 0; pos < str.size(); ++pos)
+            {
+                char ch = str[pos];
+                if(pos == 8 || pos == 13 || pos == 18 || pos == 23)
+                {
+                    if(ch != '-') return false;
+                    continue;
+                }
+                uint64_t v;
+                if(ch >= '0' && ch <= '9')  v = ch - '0';
+                else if(ch >= 'a' && ch <= 'f') v = ch - 'a' + 10;
+                else return false;
+                uint64_t& word = n < 16 ? id.hi : id.lo;
+                word = (word << 4) | v;
+                ++n;
+            }
+            return n == 32;
+        }
+
+        static uint64_t processPrefix()
+        {
+            static const uint64_t prefix = [] {
+                std::random_device rd;
+                uint64_t r = ((uint64_t)rd() << 32) | rd();
+                return r << 16;
+            }();
+            return prefix;
+        }
+
+        static std::atomic<uint64_t>& threadSeq()
+        {
+            static std::atomic<uint64_t> seq{0};
+            return seq;
+        }
+    };
+
+    struct MessageIdHash
+    {
+        size_t operator()(const MessageId& id) const
+        {
+            return id.hi * 0x9e3779b97f4a7c15ULL ^ id.lo;
+        }
+    };
+
     class UUIDHelper 
     {
     public:
         static std::string UUID() {
-            std::random_device rd;
-            std::mt19937_64 gernator(rd());
-            std::uniform_int_distribution<int> distribution(0, 255);
-            std::stringstream ss;
-            for (int i = 0; i < 8; i++) {
-                ss << std::setw(2) << std::setfill('0') << std::hex << distribution(gernator) ;
-                if (i == 3 || i == 5 || i == 7) {
-                    ss << "-";
-                }
-            }
-            static std::atomic<size_t> seq(1);
-            size_t num = seq.fetch_add(1);
-            for (int i = 7; i >= 0; i--) {
-                ss << std::setw(2) << std::setfill('0') << std::hex << ((num>>(i*8)) & 0xff);
-                if (i == 6) ss << "-";
-            }
-            return ss.str();
+            return MessageId::Generate().ToString();
         }
     };
 
@@ -180,6 +369,33 @@ namespace MyMQ
             return true;
         }
 
+        // 多段写入，只打开一次文件：(偏移, 数据)
+        bool Write(const std::vector<std::pair<size_t, std::string>>& chunks)
+        {
+            std::fstream fs(_filename, std::ios::binary | std::ios::in | std::ios::out);
+            if (!fs.is_open())
+            {
+                LOG_ERROR("{} 文件打开失败!", _filename);
+                return false;
+            }
+
+            for(auto& chunk : chunks)
+            {
+                fs.seekp(chunk.first, std::ios::beg);
+                fs.write(chunk.second.data(), chunk.second.size());
+            }
+            fs.flush();
+            if (!fs.good())
+            {
+                LOG_ERROR("{} 文件写入失败", _filename);
+                fs.close();
+                return false;
+            }
+
+            fs.close();
+            return true;
+        }
+
         bool Write(const std::string& body)
         {
             return Write(body.c_str(), 0, body.size());
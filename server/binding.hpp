@@ -2,44 +2,180 @@
 
 // #include "msgqueue.hpp"
 // #include "exchange.hpp"
-#include "help.hpp"
+#include "metastore.hpp"
+#include "route.hpp"
+#include <atomic>
 
 
 namespace MyMQ
 {
-    struct Binding;
     class BindingMapper;
     class BindingManager;
+    struct QueueHandle;
+
+    using QueueHandlePtr = std::shared_ptr<QueueHandle>;
 
-    using BindingPtr = std::shared_ptr<Binding>;    //交换机指针
-    using MsgQueueBindingMap = std::unordered_map<std::string, BindingPtr>; //交换机队列指针
-    using BindingMap = std::unordered_map<std::string, MsgQueueBindingMap>; //
     using BindingManagerPtr = std::shared_ptr<BindingManager>;  
+    using BindingList = std::vector<BindingPtr>;
+    using BindingListPtr = std::shared_ptr<const BindingList>;
 
     struct Binding
     {
         std::string exchange_name;
         std::string msgqueue_name;
         std::string binding_key;
+        google::protobuf::Map<std::string, std::string> args;   // 头部交换机的匹配条件
+        QueueHandlePtr queue;       // 目标队列句柄，绑定时解析，不持久化
 
         Binding() = default;
 
         Binding(const std::string& qexchange_name, const std::string& qmsgqueue_name, const std::string& qbinding_key)
             : exchange_name(qexchange_name), msgqueue_name(qmsgqueue_name), binding_key(qbinding_key)
         {}
+
+        Binding(const std::string& qexchange_name, const std::string& qmsgqueue_name, const std::string& qbinding_key,
+                const google::protobuf::Map<std::string, std::string>& qargs)
+            : exchange_name(qexchange_name), msgqueue_name(qmsgqueue_name), binding_key(qbinding_key), args(qargs)
+        {}
+
+        void SetArgs(const std::string& str_args)
+        {
+            std::vector<std::string> sub_args;
+            StrHelper::Split(sub_args, str_args, "&");
+            for (auto& str: sub_args)
+            {
+                size_t pos = str.find("=");
+                if(pos == std::string::npos)    continue;
+                args[str.substr(0, pos)] = str.substr(pos + 1);
+            }
+        }
+
+        std::string GetArgs()
+        {
+            std::string result;
+            for(auto start = args.begin(); start != args.end(); ++start)
+            {
+                result += start->first + "=" + start->second + "&";
+            }
+
+            return result;
+        }
     };
 
+    // 单个交换机的只读绑定快照，路由索引按交换机类型只维护一种：
+    //   DIRECT  绑定键 -> 队列列表的哈希表
+    //   FANOUT  预先展开的队列列表
+    //   TOPIC   主题匹配树
+    //   HEADERS 头部谓词倒排索引
+    //   CONSISTENT_HASH 按权重放置虚拟节点的哈希环
+    struct ExchangeBindings
+    {
+        ExchangeType type = ExchangeType::UNKOWNTYPE;
+        MsgQueueBindingMap bindings;        // 队列名 -> 绑定
+        std::unordered_map<std::string, BindingListPtr> direct;
+        BindingListPtr fanout = std::make_shared<const BindingList>();
+        TopicTrie<BindingPtr> topic;        // 随 Bind/UnBind 增量更新
+        HeadersIndex<BindingPtr> headers;
+        HashRing<BindingListPtr> ring;      // 节点保存只含该绑定的列表，路由时无需分配
+        uint64_t generation = 0;            // 生成该快照时的拓扑版本号
+        // 路由缓存在同一交换机的各个快照间共享，靠 generation 区分新旧
+        std::shared_ptr<RouteCache<BindingListPtr>> cache = std::make_shared<RouteCache<BindingListPtr>>();
+
+        ExchangeBindings() = default;
+
+        explicit ExchangeBindings(ExchangeType etype) :type(etype) {}
+
+        void Add(const BindingPtr& bp)
+        {
+            bindings.insert(std::make_pair(bp->msgqueue_name, bp));
+            switch(type)
+            {
+            case ExchangeType::DIRECT:
+            {
+                auto& list = direct[bp->binding_key];
+                auto next = list ? std::make_shared<BindingList>(*list) : std::make_shared<BindingList>();
+                next->push_back(bp);
+                list = std::move(next);
+                break;
+            }
+            case ExchangeType::FANOUT:
+            {
+                auto next = std::make_shared<BindingList>(*fanout);
+                next->push_back(bp);
+                fanout = std::move(next);
+                break;
+            }
+            case ExchangeType::TOPIC:
+                topic = topic.Insert(bp->binding_key, bp);
+                break;
+            case ExchangeType::HEADERS:
+                headers.Insert(bp->args, bp);
+                break;
+            case ExchangeType::CONSISTENT_HASH:
+            {
+                uint32_t weight = 1;
+                Router::ParseWeight(bp->binding_key, weight);
+                ring.Insert(bp->msgqueue_name, weight, std::make_shared<const BindingList>(1, bp));
+                break;
+            }
+            default:
+                break;
+            }
+        }
+
+        void Remove(const std::string& qname)
+        {
+            auto it = bindings.find(qname);
+            if(it == bindings.end())    return;
+            auto bp = it->second;
+            bindings.erase(it);
+
+            switch(type)
+            {
+            case ExchangeType::DIRECT:
+            {
+                auto dit = direct.find(bp->binding_key);
+                if(dit == direct.end()) break;
+                auto next = std::make_shared<BindingList>(*dit->second);
+                std::erase(*next, bp);
+                if(next->empty())   direct.erase(dit);
+                else dit->second = std::move(next);
+                break;
+            }
+            case ExchangeType::FANOUT:
+            {
+                auto next = std::make_shared<BindingList>(*fanout);
+                std::erase(*next, bp);
+                fanout = std::move(next);
+                break;
+            }
+            case ExchangeType::TOPIC:
+                topic = topic.Erase(bp->binding_key, bp);
+                break;
+            case ExchangeType::HEADERS:
+                headers.Erase(bp);
+                break;
+            case ExchangeType::CONSISTENT_HASH:
+                ring.EraseIf([&bp](const BindingListPtr& list) { return list->front() == bp; });
+                break;
+            default:
+                break;
+            }
+        }
+    };
+
+    using ExchangeBindingsPtr = std::shared_ptr<const ExchangeBindings>;
+    using BindingSnapshot = std::unordered_map<std::string, ExchangeBindingsPtr>;
+    using BindingSnapshotPtr = std::shared_ptr<const BindingSnapshot>;
+
     class BindingMapper //持久化管理类
     {
     private:
-        SqliteHelper _sql_helper;
+        SqliteHelperPtr _sql_helper;
     public:
-        BindingMapper(const std::string& dbfile)
-        :_sql_helper(dbfile) 
+        explicit BindingMapper(const SqliteHelperPtr& helper)
+        :_sql_helper(helper)
         {
-            std::string path = FileHelper::ParentDirectory(dbfile);
-            FileHelper::CreateDirectory(path);
-            _sql_helper.Open();
             CreateTable();
         }
 
@@ -50,26 +186,34 @@ namespace MyMQ
             sql << "create table if not exists binding_table(";
             sql << "exchange_name varchar(32), ";
             sql << "msgqueue_name varchar(32), ";
-            sql << "binding_key varchar(128));";
-            assert(_sql_helper.Exec(sql.str(), nullptr, nullptr));
+            sql << "binding_key varchar(128), ";
+            sql << "args varchar(256));";
+            assert(_sql_helper->Exec(sql.str(), nullptr, nullptr));
+
+            // 旧版本的表没有 args 列
+            bool has_args = false;
+            _sql_helper->Exec("pragma table_info(binding_table);", columnCallback, (void*)&has_args);
+            if(!has_args)
+                _sql_helper->Exec("alter table binding_table add column args varchar(256);", nullptr, nullptr);
         }
 
         void RemoveTable()
         {
             std::string sql = "drop table if exists binding_table;";
-            _sql_helper.Exec(sql, nullptr, nullptr);
+            _sql_helper->Exec(sql, nullptr, nullptr);
         }
 
-        bool Insert(BindingPtr& binding)
+        bool Insert(const BindingPtr& binding)
         {
             // insert into binding_table values('exchange1', 'msgqueue1', 'news.music.#');
             std::stringstream sql;
             sql << "insert into binding_table values(";
             sql << "'" << binding->exchange_name << "', ";
             sql << "'" << binding->msgqueue_name << "', ";
-            sql << "'" << binding->binding_key << "');";
+            sql << "'" << binding->binding_key << "', ";
+            sql << "'" << binding->GetArgs() << "');";
 
-            return _sql_helper.Exec(sql.str(), nullptr, nullptr);
+            return _sql_helper->Exec(sql.str(), nullptr, nullptr);
         }
 
         void Remove(const std::string& ename, const std::string& qname)
@@ -78,7 +222,7 @@ namespace MyMQ
             sql << "delete from binding_table where ";
             sql << "exchange_name='" << ename << "' and ";
             sql << "msgqueue_name='" << qname << "';";
-            _sql_helper.Exec(sql.str(), nullptr, nullptr);
+            _sql_helper->Exec(sql.str(), nullptr, nullptr);
         }
 
         void RemoveExchangeBindings(const std::string& ename)
@@ -86,7 +230,7 @@ namespace MyMQ
             std::stringstream sql;
             sql << "delete from binding_table where ";
             sql << "exchange_name='" << ename << "';";
-            _sql_helper.Exec(sql.str(), nullptr, nullptr);
+            _sql_helper->Exec(sql.str(), nullptr, nullptr);
         }
 
         void RemoveMsgQueueBindings(const std::string& qname)
@@ -94,14 +238,14 @@ namespace MyMQ
             std::stringstream sql;
             sql << "delete from binding_table where ";
             sql << "msgqueue_name='" << qname << "';";
-            _sql_helper.Exec(sql.str(), nullptr, nullptr);
+            _sql_helper->Exec(sql.str(), nullptr, nullptr);
         }
 
         BindingMap Recovery()
         {
             BindingMap result;
-            std::string sql = "select exchange_name, msgqueue_name, binding_key from binding_table;";
-            _sql_helper.Exec(sql, selectCallback, (void*)&result);
+            std::string sql = "select exchange_name, msgqueue_name, binding_key, args from binding_table;";
+            _sql_helper->Exec(sql, selectCallback, (void*)&result);
 
             return std::move(result);
         }
@@ -111,105 +255,269 @@ namespace MyMQ
         {
             BindingMap* result = (BindingMap*)arg;
             BindingPtr bp = std::make_shared<Binding>(row[0], row[1], row[2]);
+            if(row[3]) bp->SetArgs(row[3]);
 
             MsgQueueBindingMap &qmap = (*result)[bp->exchange_name];
             qmap.insert(std::make_pair(bp->msgqueue_name, bp));
 
             return 0;
         }
+
+        static int columnCallback(void* arg, int numcol, char** row, char** fields)
+        {
+            // pragma table_info: cid, name, type, ...
+            if(row[1] && std::string(row[1]) == "args")
+                *(bool*)arg = true;
+            return 0;
+        }
     };
 
     class BindingManager 
     {
     private:
+        // 写操作（少）在 _mtx 下复制并整体替换快照；发布路径只做一次原子读取，无锁、无拷贝
         std::mutex _mtx;
-        BindingMapper _mapper;
-        BindingMap _bindings;       
+        MetaStorePtr _store;
+        std::atomic<BindingSnapshotPtr> _snapshot;
+        std::atomic<uint64_t> _generation{0};   // 拓扑版本号，绑定变化时递增，使路由缓存失效
     public:
-        explicit BindingManager(const std::string& dbfile)
-            :_mapper(dbfile)
+        explicit BindingManager(const MetaStorePtr& store)
+            :_store(store)
+        {
+            auto recovered = _store->RecoveryBindings();
+            auto snap = std::make_shared<BindingSnapshot>();
+            for(auto& it : recovered)
+            {
+                auto eb = std::make_shared<ExchangeBindings>();
+                for(auto& qit : it.second)
+                    eb->Add(qit.second);
+                snap->insert(std::make_pair(it.first, std::move(eb)));
+            }
+            _snapshot.store(snap);
+        }
+
+        // 登记交换机类型（仅内存），已有绑定按新类型重建路由索引
+        void DeclareExchange(const std::string& ename, ExchangeType type)
         {
-            _bindings = _mapper.Recovery();
+            std::unique_lock<std::mutex> lock(_mtx);
+            auto snap = _snapshot.load();
+            auto it = snap->find(ename);
+            if(it != snap->end() && it->second->type == type)
+                return;
+
+            auto eb = std::make_shared<ExchangeBindings>(type);
+            if(it != snap->end())
+            {
+                eb->cache = it->second->cache;
+                for(auto& qit : it->second->bindings)
+                    eb->Add(qit.second);
+            }
+            eb->generation = ++_generation;
+
+            auto next = std::make_shared<BindingSnapshot>(*snap);
+            (*next)[ename] = std::move(eb);
+            _snapshot.store(std::move(next));
         }
 
-        bool Bind(const std::string &ename, const std::string &qname, const std::string &key, bool durable) 
+        bool Bind(const std::string &ename, const std::string &qname, const std::string &key, bool durable,
+                  const google::protobuf::Map<std::string, std::string>& args = {},
+                  const QueueHandlePtr& queue = nullptr) 
         {
             std::unique_lock<std::mutex> lock(_mtx);
-            auto it = _bindings.find(ename);
-            if(it != _bindings.end() && it->second.find(qname) != it->second.end()) 
+            auto snap = _snapshot.load();
+            auto it = snap->find(ename);
+            if(it != snap->end() && it->second->bindings.contains(qname)) 
                 return true;
             
-            BindingPtr bp = std::make_shared<Binding>(ename, qname, key);
+            BindingPtr bp = std::make_shared<Binding>(ename, qname, key, args);
+            bp->queue = queue;
             if(durable)
             {
-                if(!_mapper.Insert(bp))   return false;
+                if(!_store->InsertBinding(bp))   return false;
             }
 
-            _bindings[ename].insert(std::make_pair(qname, bp));
+            auto eb = it != snap->end() ? std::make_shared<ExchangeBindings>(*it->second)
+                                        : std::make_shared<ExchangeBindings>();
+            eb->Add(bp);
+            eb->generation = ++_generation;
+
+            auto next = std::make_shared<BindingSnapshot>(*snap);
+            (*next)[ename] = std::move(eb);
+            _snapshot.store(std::move(next));
             return true;
         }
 
-        void UnBind(const std::string &ename, const std::string &qname) 
+        // persist 为 false 时只修改内存中的绑定，用于事务回滚后撤销内存状态
+        void UnBind(const std::string &ename, const std::string &qname, bool persist = true) 
         {
-            auto eit = _bindings.find(ename);
-            if(eit == _bindings.end())  return;
-            auto qit = eit->second.find(qname);
-            if(qit == eit->second.end())    return;
+            std::unique_lock<std::mutex> lock(_mtx);
+            auto snap = _snapshot.load();
+            auto eit = snap->find(ename);
+            if(eit == snap->end())  return;
+            if(!eit->second->bindings.contains(qname))    return;
+
+            if(persist) _store->RemoveBinding(ename, qname);
+
+            auto eb = std::make_shared<ExchangeBindings>(*eit->second);
+            eb->Remove(qname);
+            eb->generation = ++_generation;
+            auto next = std::make_shared<BindingSnapshot>(*snap);
+            (*next)[ename] = std::move(eb);
+            _snapshot.store(std::move(next));
+        }
 
-            _mapper.Remove(ename, qname);
-            _bindings[ename].erase(qname);
+        void RemoveExchangeBindings(const std::string& ename, bool persist = true)
+        {
+            std::unique_lock<std::mutex> lock(_mtx);
+            if(persist) _store->RemoveExchangeBindings(ename);
+            ++_generation;
+
+            auto snap = _snapshot.load();
+            if(!snap->contains(ename))  return;
+            auto next = std::make_shared<BindingSnapshot>(*snap);
+            next->erase(ename);
+            _snapshot.store(std::move(next));
         }
 
-        void RemoveExchangeBindings(const std::string& ename)
+        // 恢复的绑定没有队列句柄，队列就绪后补上
+        void AttachQueue(const std::string& qname, const QueueHandlePtr& queue)
         {
             std::unique_lock<std::mutex> lock(_mtx);
-            _mapper.RemoveExchangeBindings(ename);
-            _bindings.erase(ename);
+            auto next = std::make_shared<BindingSnapshot>(*_snapshot.load());
+            for(auto& it : *next)
+            {
+                auto qit = it.second->bindings.find(qname);
+                if(qit == it.second->bindings.end() || qit->second->queue == queue)
+                    continue;
+
+                auto bp = std::make_shared<Binding>(*qit->second);
+                bp->queue = queue;
+                auto eb = std::make_shared<ExchangeBindings>(*it.second);
+                eb->Remove(qname);
+                eb->Add(bp);
+                eb->generation = ++_generation;
+                it.second = std::move(eb);
+            }
+            _snapshot.store(std::move(next));
         }
 
         void RemoveMsgQueueBindings(const std::string& qname)
         {
             std::unique_lock<std::mutex> lock(_mtx);
-            _mapper.RemoveMsgQueueBindings(qname);
-            for(auto & _binding : _bindings)
+            _store->RemoveMsgQueueBindings(qname);
+
+            auto next = std::make_shared<BindingSnapshot>(*_snapshot.load());
+            for(auto& it : *next)
             {
-                _binding.second.erase(qname);
+                if(!it.second->bindings.contains(qname))   continue;
+                auto eb = std::make_shared<ExchangeBindings>(*it.second);
+                eb->Remove(qname);
+                eb->generation = ++_generation;
+                it.second = std::move(eb);
             }
+            _snapshot.store(std::move(next));
+        }
 
+        // 返回该交换机绑定的只读快照；快照在持有期间不会被修改
+        ExchangeBindingsPtr GetExchangeBindings(const std::string &ename) 
+        {
+            static const ExchangeBindingsPtr empty = std::make_shared<const ExchangeBindings>();
+
+            auto snap = _snapshot.load();
+            auto it = snap->find(ename);
+            if(it == snap->end())   return empty;
+
+            return it->second;
         }
 
-        MsgQueueBindingMap GetExchangeBindings(const std::string &ename) 
+        // 路由：交换机类型已登记时使用对应的专用索引——DIRECT 一次哈希查找，
+        // FANOUT 直接返回预先展开的列表，TOPIC 查缓存后走匹配树；
+        // 未登记类型的交换机退回逐个绑定比较，结果同样写入缓存。
+        BindingListPtr Route(const std::string& ename, ExchangeType type, const std::string& routingKey)
         {
-            std::unique_lock<std::mutex> lock(_mtx);
+            static const BindingListPtr none = std::make_shared<const BindingList>();
 
-            return _bindings[ename];
+            auto eb = GetExchangeBindings(ename);
+            if(eb->bindings.empty())    return none;
+
+            if(eb->type == type)
+            {
+                if(type == ExchangeType::DIRECT)
+                {
+                    auto it = eb->direct.find(routingKey);
+                    return it == eb->direct.end() ? none : it->second;
+                }
+                if(type == ExchangeType::FANOUT)
+                    return eb->fanout;
+            }
+
+            if(auto hit = eb->cache->Lookup(routingKey, eb->generation))
+                return hit;
+
+            auto result = std::make_shared<BindingList>();
+            if(eb->type == type && type == ExchangeType::TOPIC)
+            {
+                eb->topic.Match(routingKey, *result);
+            }
+            else
+            {
+                for(auto& it : eb->bindings)
+                {
+                    if(Router::Route(type, routingKey, it.second->binding_key))
+                        result->push_back(it.second);
+                }
+            }
+
+            eb->cache->Store(routingKey, eb->generation, result);
+            return result;
         }
 
-        BindingPtr GetBinding(const std::string &ename, const std::string &qname) 
+        // 头部交换机：按消息头部查倒排索引，头部组合太多，不走路由缓存
+        BindingListPtr RouteHeaders(const std::string& ename, const google::protobuf::Map<std::string, std::string>& headers)
         {
-            std::unique_lock<std::mutex> lock(_mtx);
+            static const BindingListPtr none = std::make_shared<const BindingList>();
+
+            auto eb = GetExchangeBindings(ename);
+            if(eb->type != ExchangeType::HEADERS || eb->headers.Empty())
+                return none;
 
-            return _bindings[ename][qname];
+            auto result = std::make_shared<BindingList>();
+            eb->headers.Match(headers, *result);
+            return result;
         }
 
-        bool Exists(const std::string &ename, const std::string &qname) 
+        // 一致性哈希交换机：同一个键总是落到同一个队列
+        BindingListPtr RouteHash(const std::string& ename, std::string_view key)
         {
-            std::unique_lock<std::mutex> lock(_mtx);
+            static const BindingListPtr none = std::make_shared<const BindingList>();
+
+            auto eb = GetExchangeBindings(ename);
+            if(eb->type != ExchangeType::CONSISTENT_HASH || eb->ring.Empty())
+                return none;
+            return eb->ring.Locate(key);
+        }
 
-            auto eit = _bindings.find(ename);
-            if(eit == _bindings.end())  return false;
-            auto qit = eit->second.find(qname);
+        BindingPtr GetBinding(const std::string &ename, const std::string &qname) 
+        {
+            auto eb = GetExchangeBindings(ename);
+            auto it = eb->bindings.find(qname);
+            if(it == eb->bindings.end())   return BindingPtr();
 
-            return qit != eit->second.end();
+            return it->second;
+        }
+
+        bool Exists(const std::string &ename, const std::string &qname) 
+        {
+            return GetExchangeBindings(ename)->bindings.contains(qname);
         }
 
         size_t Size()
         {
-            std::unique_lock<std::mutex> lock(_mtx);
+            auto snap = _snapshot.load();
             size_t ret = 0;
-            for(auto it = _bindings.begin(); it != _bindings.end(); ++it)
+            for(auto it = snap->begin(); it != snap->end(); ++it)
             {
-                ret += it->second.size();
+                ret += it->second->bindings.size();
             }
 
             return ret;
@@ -218,8 +526,8 @@ namespace MyMQ
         void Clear()
         {
             std::unique_lock<std::mutex> lock(_mtx);
-            _mapper.RemoveTable();
-            _bindings.clear();
+            _store->ClearBindings();
+            _snapshot.store(std::make_shared<BindingSnapshot>());
         }
     };
 }
\ No newline at end of file
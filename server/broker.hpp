@@ -24,27 +24,26 @@ namespace MyMQ
         TcpServer _server;
         ProtobufDispatcher _dispatcher;
         ProtobufCodecPtr _codec;
+        ConsumerManagerPtr _cmp;    // 须先于 _host 构造，由虚拟主机一并管理各队列的消费者
+        FlowControlPtr _flow;       // 须先于 _host 构造，队列消息的内存统计
         VirtualHostPtr _host;
-        ConsumerManagerPtr _cmp;
         ConnectionManagerPtr _cnmp;
         ThreadPool *_pool;
+        ShardedExecutorPtr _executor;   // 发布入队按目标队列分片执行
     public:
-        Server(int port, const std::string &basedir)
+        Server(int port, const std::string &basedir, MetaBackend backend = MetaBackend::SQLITE,
+               const FlowOptions& flow = FlowOptions())
         : _server(&_baseloop, muduo::net::InetAddress(port), "server", muduo::net::TcpServer::kReusePort),
           _dispatcher(std::bind(&Server::OnUnknownMessage, this, _1, _2, _3)),
           _codec(std::make_shared<ProtobufCodec>(
                   std::bind(&ProtobufDispatcher::onProtobufMessage, &_dispatcher, _1, _2, _3))),
-          _host(std::make_shared<VirtualHost>(HOSTNAME, basedir, basedir + DBFILE)),
           _cmp(std::make_shared<ConsumerManager>()),
+          _flow(std::make_shared<FlowControl>(flow)),
+          _host(std::make_shared<VirtualHost>(HOSTNAME, basedir, basedir + DBFILE, backend, _cmp, _flow)),
           _cnmp(std::make_shared<ConnectionManager>()),
-          _pool(ThreadPool::getInstance(1))
+          _pool(ThreadPool::getInstance(std::max(1u, std::thread::hardware_concurrency()))),
+          _executor(std::make_shared<ShardedExecutor>())
         {
-            auto map = _host->AllQueue();
-            for(auto& it : map)
-            {
-                _cmp->InitQueueConsumer(it.first);
-            }
-
             _dispatcher.registerMessageCallback<OpenChannelRequest>(std::bind(&Server::OnOpenChannel, this, _1, _2, _3));
             _dispatcher.registerMessageCallback<CloseChannelRequest>(std::bind(&Server::CloseOpenChannel, this, _1, _2, _3));
             _dispatcher.registerMessageCallback<DeclareExchangeRequest>(std::bind(&Server::OnDeclareExchange, this, _1, _2, _3));
@@ -53,13 +52,22 @@ namespace MyMQ
             _dispatcher.registerMessageCallback<DeleteQueueRequest>(std::bind(&Server::OnDeleteQueue, this, _1, _2, _3));
             _dispatcher.registerMessageCallback<QueueBindRequest>(std::bind(&Server::OnQueueBind, this, _1, _2, _3));
             _dispatcher.registerMessageCallback<QueueUnBindRequest>(std::bind(&Server::OnQueueUnBind, this, _1, _2, _3));
+            _dispatcher.registerMessageCallback<DeclareTopologyRequest>(std::bind(&Server::OnDeclareTopology, this, _1, _2, _3));
             _dispatcher.registerMessageCallback<BasicPublishRequest>(std::bind(&Server::OnBasicPublish, this, _1, _2, _3));
+            _dispatcher.registerMessageCallback<BasicPublishBatchRequest>(std::bind(&Server::OnBasicPublishBatch, this, _1, _2, _3));
+            _dispatcher.registerMessageCallback<ConfirmSelectRequest>(std::bind(&Server::OnConfirmSelect, this, _1, _2, _3));
             _dispatcher.registerMessageCallback<BasicAckRequest>(std::bind(&Server::OnBasicAck, this, _1, _2, _3));
+            _dispatcher.registerMessageCallback<BasicQosRequest>(std::bind(&Server::OnBasicQos, this, _1, _2, _3));
             _dispatcher.registerMessageCallback<BasicConsumeRequest>(std::bind(&Server::OnBasicConsume, this, _1, _2, _3));
             _dispatcher.registerMessageCallback<BasicCancelRequest>(std::bind(&Server::OnBasicCancel, this, _1, _2, _3));
+            _dispatcher.registerMessageCallback<BasicGetRequest>(std::bind(&Server::OnBasicGet, this, _1, _2, _3));
 
             _server.setMessageCallback(std::bind(&ProtobufCodec::onMessage, _codec.get(), _1, _2, _3));
             _server.setConnectionCallback(std::bind(&Server::OnConnection, this, _1));
+            _server.setWriteCompleteCallback(std::bind(&Server::OnWriteComplete, this, _1));
+            _flow->SetCallback([this](bool blocked, const std::string& reason) {
+                _cnmp->SetBlocked(blocked, reason);
+            });
         }
 
         void Start()
@@ -89,7 +97,8 @@ namespace MyMQ
         // 处理连接
         void OnConnection(const TcpConnectionPtr &conn) {
             if (conn->connected()) {
-                _cnmp->NewConnection(_host, _cmp, _codec, conn, _pool);
+                _cnmp->NewConnection(_host, _cmp, _codec, conn, _pool, _flow, _executor.get());
+                conn->setHighWaterMarkCallback(std::bind(&Server::OnHighWaterMark, this, _1, _2), _flow->SocketHigh());
             }
             else {
                 _cnmp->DeleteConnection(conn);
@@ -97,6 +106,18 @@ namespace MyMQ
             LOG_INFO("{} 连接 {}", conn->peerAddress().toIpPort(), conn->connected() ? "UP" : "DOWN");
         }
 
+        // 发送缓冲区堆积（消费者过慢）时触发套接字告警，写完后解除
+        void OnHighWaterMark(const TcpConnectionPtr& conn, size_t len) {
+            LOG_INFO("{} 发送缓冲区达到 {} 字节", conn->peerAddress().toIpPort(), len);
+            auto connection = _cnmp->GetConnection(conn);
+            if (connection) connection->OnHighWaterMark();
+        }
+
+        void OnWriteComplete(const TcpConnectionPtr& conn) {
+            auto connection = _cnmp->GetConnection(conn);
+            if (connection) connection->OnWriteComplete();
+        }
+
         // 打开信道
         void OnOpenChannel(const TcpConnectionPtr &conn, const OpenChannelRequestPtr &req, muduo::Timestamp) {
             auto connection = GetValidConnection(conn, "打开信道");
@@ -195,11 +216,26 @@ namespace MyMQ
             }
         }
 
+        // 批量声明拓扑
+        void OnDeclareTopology(const TcpConnectionPtr& conn, const DeclareTopologyRequestPtr& req, muduo::Timestamp)
+        {
+            auto connection = GetValidConnection(conn, "批量声明");
+            if (connection)
+            {
+                auto ch = connection->GetChannel(req->cid());
+                if (ch)
+                {
+                    ch->DeclareTopology(req);
+                }
+            }
+        }
+
         void OnBasicPublish(const TcpConnectionPtr& conn, const BasicPushlishRequestPtr& req, muduo::Timestamp)
         {
             auto connection = GetValidConnection(conn, "发布信息");
             if(connection)
             {
+                connection->OnPublish();
                 auto ch = connection->GetChannel(req->cid());
                 if(!ch) {
                     LOG_DEBUG("没有找到信号");
@@ -209,6 +245,27 @@ namespace MyMQ
             }
         }
 
+        void OnBasicPublishBatch(const TcpConnectionPtr& conn, const BasicPublishBatchRequestPtr& req, muduo::Timestamp)
+        {
+            auto connection = GetValidConnection(conn, "批量发布");
+            if(connection)
+            {
+                connection->OnPublish();
+                auto ch = connection->GetChannel(req->cid());
+                if(ch)  ch->BasicPublishBatch(req);
+            }
+        }
+
+        void OnConfirmSelect(const TcpConnectionPtr& conn, const ConfirmSelectRequestPtr& req, muduo::Timestamp)
+        {
+            auto connection = GetValidConnection(conn, "发布确认");
+            if(connection)
+            {
+                auto ch = connection->GetChannel(req->cid());
+                if(ch)  ch->ConfirmSelect(req);
+            }
+        }
+
         void OnBasicAck(const TcpConnectionPtr& conn, const BasicAckRequestPtr& req, muduo::Timestamp)
         {
             auto connection = GetValidConnection(conn, "消息确认");
@@ -218,6 +275,16 @@ namespace MyMQ
                 if(ch)  ch->BasicAck(req);
             }
         }
+        void OnBasicQos(const TcpConnectionPtr& conn, const BasicQosRequestPtr& req, muduo::Timestamp)
+        {
+            auto connection = GetValidConnection(conn, "预取设置");
+            if(connection)
+            {
+                auto ch = connection->GetChannel(req->cid());
+                if(ch)  ch->BasicQos(req);
+            }
+        }
+
         void OnBasicConsume(const TcpConnectionPtr& conn, const BasicConsumeRequestPtr& req, muduo::Timestamp)
         {
             LOG_DEBUG("进入OnBasicConsume");
@@ -240,5 +307,16 @@ namespace MyMQ
                     ch->BasicCancel(req);
             }
         }
+
+        void OnBasicGet(const TcpConnectionPtr& conn, const BasicGetRequestPtr& req, muduo::Timestamp)
+        {
+            auto connection = GetValidConnection(conn, "拉取消息");
+            if(connection)
+            {
+                auto ch = connection->GetChannel(req->cid());
+                if(ch)
+                    ch->BasicGet(req);
+            }
+        }
     };
 }
\ No newline at end of file
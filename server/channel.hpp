@@ -5,6 +5,9 @@
 #include "consumer.hpp"
 #include "mqproto.pb.h"
 #include "host.hpp"
+#include "delivery.hpp"
+#include "executor.hpp"
+#include <map>
 #include "codec.h"
 #include "dispatcher.h"
 #include "help.hpp"
@@ -30,15 +33,20 @@ namespace MyMQ
 
     using QueueBindRequestPtr = std::shared_ptr<QueueBindRequest>;
     using QueueUnBindRequestPtr = std::shared_ptr<QueueUnBindRequest>;
+    using DeclareTopologyRequestPtr = std::shared_ptr<DeclareTopologyRequest>;
 
     using BasicPushlishRequestPtr = std::shared_ptr<BasicPublishRequest>;
+    using BasicPublishBatchRequestPtr = std::shared_ptr<BasicPublishBatchRequest>;
+    using ConfirmSelectRequestPtr = std::shared_ptr<ConfirmSelectRequest>;
+    using BasicQosRequestPtr = std::shared_ptr<BasicQosRequest>;
     using BasicAckRequestPtr = std::shared_ptr<BasicAckRequest>;
     using BasicConsumeRequestPtr = std::shared_ptr<BasicConsumeRequest>;
     using BasicConsumeResponsePtr = std::shared_ptr<BasicConsumeResponse>;
     using BasicCancelRequestPtr = std::shared_ptr<BasicCancelRequest>;
+    using BasicGetRequestPtr = std::shared_ptr<BasicGetRequest>;
     using BasicCommonResponsePtr = std::shared_ptr<BasicCommonResponse>;
 
-    class Channel
+    class Channel : public std::enable_shared_from_this<Channel>
     {
     private:
         std::string _cid;
@@ -48,21 +56,51 @@ namespace MyMQ
         ConsumerPtr _consumer;
         muduo::net::TcpConnectionPtr _conn;
         ThreadPool* _pool;
+        DeliveryWindow _unacked;    // 本信道已投递、待确认的消息
+        std::atomic<bool> _confirm{false};  // 发布确认模式
+        uint32_t _prefetch_count = 0;       // 本信道消费者的预取限制，0 表示不限制
+        uint32_t _prefetch_size = 0;
+        ShardedExecutor* _executor; // 按目标队列分片执行发布，为空时在网络线程内执行
+
+        // 发布在各分片上并发完成，应答按请求到达的顺序发出
+        struct PublishJob
+        {
+            uint64_t index;             // 本信道内的发布序号
+            std::string rid;
+            uint64_t seq;               // 确认模式下应答的序号
+            std::atomic<bool> ok;       // 任一目标队列入队失败即为 false
+            std::atomic<size_t> remaining;  // 尚未完成的目标队列数
+        };
+        using PublishJobPtr = std::shared_ptr<PublishJob>;
+
+        std::mutex _pub_mutex;
+        uint64_t _pub_next = 0;     // 下一个发布序号
+        uint64_t _pub_done = 0;     // 此前的发布都已应答
+        std::map<uint64_t, PublishJobPtr> _pub_ready;  // 已完成、等待按序应答的发布
     public:
         Channel(const std::string& id, const VirtualHostPtr& host, const ConsumerManagerPtr& cmp,
-                const ProtobufCodecPtr& codec, const muduo::net::TcpConnectionPtr& conn, ThreadPool* pool)
-                :_cid(id), _host(host), _cmp(cmp), _codec(codec), _conn(conn), _pool(pool)
+                const ProtobufCodecPtr& codec, const muduo::net::TcpConnectionPtr& conn, ThreadPool* pool,
+                ShardedExecutor* executor = nullptr)
+                :_cid(id), _host(host), _cmp(cmp), _codec(codec), _conn(conn), _pool(pool), _executor(executor)
         {
             LOG_DEBUG("new channel.hpp");
         }
 
         ~Channel()
+        {
+            Close();
+            LOG_DEBUG("delete Channel");
+        }
+
+        // 信道关闭或连接断开：先注销消费者，再关闭投递窗口并把未确认的消息退回队列重新投递。
+        // 投递任务可能仍持有本信道，此后它们的投递会被窗口拒绝并退回队列；可重复调用
+        void Close()
         {
             if(_consumer.get() != nullptr)
             {
                 _cmp->Remove(_consumer->tag, _consumer->qname);
             }
-            LOG_DEBUG("delete Channel");
+            requeueUnacked();
         }
 
         void DeclareExchange(const DeclareExchangeRequestPtr& rep)
@@ -80,24 +118,18 @@ namespace MyMQ
         void DeclareQueue(const DeclareQueueRequestPtr& req)
         {
             bool ret = _host->DeclareQueue(req->queue_name(), req->durable(), req->exclusive(), req->auto_delete(), req->args());
-
-            if(!ret)
-                return basicResponse(false, req->rid(), req->cid());
-            
-            _cmp->InitQueueConsumer(req->queue_name());
-            return basicResponse(true, req->rid(), req->cid());
+            return basicResponse(ret, req->rid(), req->cid());
         }
 
         void DeleteQueue(const DeleteQueueRequestPtr& req)
         {
             _host->DeleteQueue(req->queue_name());
-            _cmp->DestoryQueueConsumer(req->queue_name());
             return basicResponse(true, req->rid(), req->cid());
         }
 
         void QueueBind(const QueueBindRequestPtr& req)
         {
-            bool ret = _host->Bind(req->exchange_name(), req->queue_name(), req->binding_key());
+            bool ret = _host->Bind(req->exchange_name(), req->queue_name(), req->binding_key(), req->args());
             return basicResponse(ret, req->rid(), req->cid());
         }
 
@@ -107,32 +139,124 @@ namespace MyMQ
             return basicResponse(true, req->rid(), req->cid());
         }
 
+        void DeclareTopology(const DeclareTopologyRequestPtr& req)
+        {
+            bool ret = _host->DeclareTopology(*req);
+            return basicResponse(ret, req->rid(), req->cid());
+        }
+
+        // 在网络线程完成路由，入队交给目标队列所在的分片，同一队列的消息保持到达顺序
         void BasicPublish(const BasicPushlishRequestPtr& req)
         {
+            auto job = newJob(req->rid(), req->publish_seq());
             // 选择交换机
             auto exp = _host->SelectExchange(req->exchange_name());
-            if(!exp.get())  return basicResponse(false, req->rid(), req->cid());
+            if(!exp.get())
+            {
+                job->ok = false;
+                return finishJob(job);
+            }
 
-            // 获取交换机中的绑定队列
-            auto map = _host->ExchangeBindings(req->exchange_name());
-            BasicProperties* bp;
-            std::string routingKey{};
+            BasicProperties* bp = nullptr;
             if(req->has_properties())
             {
                 bp = req->mutable_properties();
-                routingKey = bp->routing_key();
             }
-            // 推送信息
-            for(auto& it : map)
+            // 路由到匹配的队列并推送信息
+            auto targets = _host->Route(exp, bp);
+            std::vector<QueueHandlePtr> queues;
+            for(auto& binding : *targets)
             {
-                //  路由匹配则发送
-                if(Router::Route(exp->type, routingKey, it.second->binding_key))
+                if(binding->queue)  queues.push_back(binding->queue);
+            }
+            if(queues.empty())  return finishJob(job);
+
+            job->remaining = queues.size();
+            auto self = shared_from_this();
+            for(auto& queue : queues)
+            {
+                submit(queue, [self, job, queue, req, bp] {
+                    // req 由回调持有，消息体的引用在任务完成前有效
+                    self->publishOne(queue, bp, req->body(), [self, job, req](bool ok) {
+                        if(!ok) job->ok = false;
+                        self->completeJob(job);
+                    });
+                });
+            }
+        }
+
+        // 批量发布：相同交换机与路由键只路由一次，按目标队列分组后每个队列插入一次
+        void BasicPublishBatch(const BasicPublishBatchRequestPtr& req)
+        {
+            uint64_t seq = req->entries_size() > 0 ? req->publish_seq() + req->entries_size() - 1 : req->publish_seq();
+            auto job = newJob(req->rid(), seq);
+            std::unordered_map<std::string, ExchangePtr> exchanges;
+            std::unordered_map<QueueHandle*, std::pair<QueueHandlePtr, std::vector<MessageRef>>> groups;
+            std::vector<QueueHandle*> order;     // 队列首次出现的顺序
+
+            const PublishEntry* last = nullptr;
+            BindingListPtr targets;
+            for(auto& entry : *req->mutable_entries())
+            {
+                auto eit = exchanges.find(entry.exchange_name());
+                if(eit == exchanges.end())
+                    eit = exchanges.emplace(entry.exchange_name(), _host->SelectExchange(entry.exchange_name())).first;
+                const ExchangePtr& exp = eit->second;
+                if(!exp.get())
                 {
-                    _host->BasicPublish(it.first, bp, req->body());
-                    auto task = std::bind(&Channel::consume, this, it.first);
-                    _pool->enqueue(task);
+                    job->ok = false;
+                    continue;
+                }
+
+                BasicProperties* bp = entry.has_properties() ? entry.mutable_properties() : nullptr;
+                if(!reuseRoute(exp, last, entry))
+                    targets = _host->Route(exp, bp);
+                last = &entry;
+
+                for(auto& binding : *targets)
+                {
+                    const QueueHandlePtr& queue = binding->queue;
+                    if(!queue)  continue;
+                    auto& group = groups[queue.get()];
+                    if(!group.first)
+                    {
+                        group.first = queue;
+                        order.push_back(queue.get());
+                    }
+                    group.second.emplace_back(bp, &entry.body());
                 }
             }
+            if(order.empty())   return finishJob(job);
+
+            job->remaining = order.size();
+            auto self = shared_from_this();
+            for(auto q : order)
+            {
+                auto& group = groups[q];
+                QueueHandlePtr queue = group.first;
+                // 消息引用指向 req 内部，任务持有 req 保证其存活
+                submit(queue, [self, job, queue, req, batch = std::move(group.second)]() mutable {
+                    auto insert = [self, job, queue, req, batch = std::move(batch)] {
+                        size_t n = self->_host->BasicPublish(queue, batch);
+                        if(n < batch.size())    job->ok = false;
+                        if(n > 0)   self->drain(queue);
+                        self->completeJob(job);
+                    };
+                    // 有直通任务在 strand 上排队时排在它们之后，保持消息顺序
+                    if(queue->handoff_pending.load() == 0)
+                        return insert();
+                    ++queue->handoff_pending;
+                    queue->strand->Post(self->_pool, [queue, insert = std::move(insert)] {
+                        insert();
+                        --queue->handoff_pending;
+                    });
+                });
+            }
+        }
+
+        void ConfirmSelect(const ConfirmSelectRequestPtr& req)
+        {
+            _confirm = true;
             return basicResponse(true, req->rid(), req->cid());
         }
 
@@ -140,12 +264,79 @@ namespace MyMQ
         {
             bool ret = _host->ExistQueue(req->queue_name());
             if(!ret)    return basicResponse(false, req->rid(), req->cid());
-            auto cb = std::bind(&Channel::callback, this, _1, _2, _3);
-            _consumer = _cmp->Create(req->consumer_tag(), req->queue_name(), req->auto_ack(), cb);
+            // 消费者可能被投递任务从旧快照中取出，回调只持有信道的弱引用；信道已销毁时消息退回队列
+            std::weak_ptr<Channel> weak = weak_from_this();
+            auto cb = [weak](const std::string& tag, const BasicProperties* bp, const std::string& body) {
+                if(auto self = weak.lock())  self->callback(tag, bp, body);
+            };
+            ThreadPool* pool = _pool;
+            auto deliver = [weak, pool](const ConsumerPtr& cp, const QueueHandlePtr& queue, const DeliveryBatch& batch) {
+                if(auto self = weak.lock())
+                    return self->deliver(cp, queue, batch);
+                requeue(pool, cp, queue, batch, 0);
+            };
+            int32_t priority = 0;
+            auto pit = req->args().find("x-priority");
+            if(pit != req->args().end())    priority = std::atoi(pit->second.c_str());
+            ConsumerLimits limits;
+            limits.prefetch_count = _prefetch_count;
+            limits.prefetch_size = _prefetch_size;
+            limits.max_batch = req->max_batch();
+            limits.max_batch_bytes = req->max_batch_bytes();
+            _consumer = _cmp->Create(req->consumer_tag(), req->queue_name(), req->auto_ack(), cb, deliver, priority, limits);
+            if(_consumer)
+            {
+                // 投递订阅前积压的消息
+                if(auto queue = _host->SelectQueueHandle(req->queue_name()))
+                    drain(queue);
+            }
 
             return basicResponse(true, req->rid(), req->cid());
         }
 
+        // 设置预取限制，作用于本信道当前与之后的消费者；放宽限制后立即补投
+        void BasicQos(const BasicQosRequestPtr& req)
+        {
+            _prefetch_count = req->prefetch_count();
+            _prefetch_size = req->prefetch_size();
+            if(_consumer)
+            {
+                _consumer->prefetch_count = _prefetch_count;
+                _consumer->prefetch_size = _prefetch_size;
+                if(auto queue = _host->SelectQueueHandle(_consumer->qname))
+                    drain(queue);
+            }
+            return basicResponse(true, req->rid(), req->cid());
+        }
+
+        // 拉取消息：在队列的 strand 上执行，与推送投递互不交错。
+        // 队列为空且允许等待时挂在队列上，由下一次投递任务或超时定时器应答
+        void BasicGet(const BasicGetRequestPtr& req)
+        {
+            auto queue = _host->SelectQueueHandle(req->queue_name());
+            if(!queue)  return getResponse(req->rid(), false);
+
+            std::weak_ptr<Channel> weak = weak_from_this();
+            auto loop = _conn->getLoop();
+            queue->strand->Post(_pool, [weak, queue, req, loop] {
+                auto self = weak.lock();
+                if(!self)   return;
+                if(self->pull(queue, *req, req->timeout_ms() == 0) > 0 || req->timeout_ms() == 0)
+                    return;
+
+                auto waiter = std::make_shared<GetWaiter>();
+                waiter->serve = [weak, req](const QueueHandlePtr& queue) {
+                    if(auto self = weak.lock())  self->pull(queue, *req, true);
+                };
+                pruneGetters(queue);
+                queue->getters.push_back(waiter);
+                loop->runAfter(req->timeout_ms() / 1000.0, [weak, waiter, req] {
+                    if(waiter->done.exchange(true))  return;
+                    if(auto self = weak.lock())  self->getResponse(req->rid(), true);
+                });
+            });
+        }
+
         void BasicCancel(const BasicCancelRequestPtr& req)
         {
             _cmp->Remove(req->consumer_tag(), req->queue_name());
@@ -154,44 +345,455 @@ namespace MyMQ
 
         void BasicAck(const BasicAckRequestPtr& req)
         {
-            _host->BasicAck(req->queue_name(), req->message_id());
-            return basicResponse(true, req->rid(), req->cid());
+            bool ret = true;
+            if(req->multiple() || req->ranges_size() > 0)
+            {
+                std::vector<Delivery> acked;
+                if(req->multiple())
+                    _unacked.AckUpTo(req->delivery_tag(), acked);
+                else if(req->delivery_tag() != 0)
+                    _unacked.AckRange(req->delivery_tag(), req->delivery_tag(), acked);
+                for(auto& range : req->ranges())
+                    _unacked.AckRange(range.first(), range.last(), acked);
+                ret = !acked.empty();
+                removeAcked(acked);
+            }
+            else
+            {
+                // 只带 message_id 的旧式确认：消息在本信道窗口内时与按标签确认走同一条路径，
+                // 归还预取额度并继续投递；窗口内还有未确认的投递却找不到该 ID 时拒绝，
+                // 否则直接从队列删除会让窗口里的那一项永远不被结清
+                Delivery d;
+                if(req->delivery_tag() != 0)
+                    ret = _unacked.Ack(req->delivery_tag(), d);
+                else if(_unacked.AckId(MessageId::FromString(req->message_id()), d))
+                    ret = true;
+                else if(_unacked.Unacked() > 0)
+                {
+                    LOG_ERROR("信道 {} 有未确认的投递，拒绝未知的消息 ID 确认: {}", _cid, req->message_id());
+                    ret = false;
+                }
+                else
+                {
+                    _host->BasicAck(req->queue_name(), req->message_id());
+                }
+
+                if(ret && d.queue)
+                {
+                    ret = d.queue->messages->Remove(d.id);
+                    if(d.consumer)  d.consumer->Release(d.bytes);
+                    drain(d.queue);
+                }
+            }
+
+            if(req->no_wait())  return;
+            return basicResponse(ret, req->rid(), req->cid());
         }
 
     private:
+        // 与上一条发往同一交换机且路由结果只取决于路由键时，沿用上一条的路由结果
+        static bool reuseRoute(const ExchangePtr& exp, const PublishEntry* last, const PublishEntry& entry)
+        {
+            if(!last || last->exchange_name() != entry.exchange_name())
+                return false;
+            if(exp->type == ExchangeType::HEADERS || exp->type == ExchangeType::CONSISTENT_HASH)
+                return false;
+            return last->properties().routing_key() == entry.properties().routing_key();
+        }
+
         void callback(const std::string& tag, const BasicProperties* bp, const std::string& body)
+        {
+            sendConsumeResponse(tag, bp, body, 0);
+        }
+
+        // 投递到本信道的订阅者：手动确认的消息先登记投递标签再推送；多条时合成一帧
+        // 信道已关闭时不再推送：已登记的消息由关闭流程退回，其余的在这里退回
+        void deliver(const ConsumerPtr& cp, const QueueHandlePtr& queue, const DeliveryBatch& batch)
+        {
+            std::vector<uint64_t> tags(batch.size(), 0);
+            if(!cp->autoAck)
+            {
+                for(size_t i = 0; i < batch.size(); ++i)
+                {
+                    tags[i] = _unacked.Push(queue, batch[i].first, batch[i].second, cp);
+                    if(tags[i] == 0)
+                        return requeue(_pool, cp, queue, batch, i);
+                    cp->Charge(batch[i].first->payload().body().size());
+                }
+            }
+            else if(_unacked.Closed())
+            {
+                return requeue(_pool, cp, queue, batch, 0);
+            }
+
+            if(batch.size() == 1)
+            {
+                auto& payload = batch[0].first->payload();
+                sendConsumeResponse(cp->tag, &payload.properties(), payload.body(), tags[0], &batch[0].second);
+            }
+            else
+            {
+                BasicConsumeBatchResponse resp;
+                resp.set_cid(_cid);
+                resp.set_consumer_tag(cp->tag);
+                for(size_t i = 0; i < batch.size(); ++i)
+                {
+                    auto& payload = batch[i].first->payload();
+                    auto entry = resp.add_entries();
+                    entry->set_body(payload.body());
+                    copyProperties(payload.properties(), entry->mutable_properties(), &batch[i].second);
+                    entry->set_delivery_tag(tags[i]);
+                }
+                _codec->send(_conn, resp);
+            }
+
+            if(cp->autoAck)
+            {
+                std::vector<MessageId> ids;
+                for(auto& it : batch)   ids.push_back(it.second);
+                queue->messages->Remove(ids);
+            }
+        }
+
+        // 把 batch[from..] 放回队头并退还其预取额度
+        static void requeue(ThreadPool* pool, const ConsumerPtr& cp, const QueueHandlePtr& queue,
+                            const DeliveryBatch& batch, size_t from)
+        {
+            std::vector<MessageId> ids;
+            for(size_t i = from; i < batch.size(); ++i)
+            {
+                ids.push_back(batch[i].second);
+                cp->Refund();
+            }
+            queue->messages->Requeue(ids);
+            drain(pool, queue);
+        }
+
+        // 本信道未确认的消息按队列分组，每个队列保持原投递顺序一次放回队头；归还额度后补投
+        void requeueUnacked()
+        {
+            std::vector<Delivery> unacked;
+            if(_unacked.TakeAll(unacked) == 0)  return;
+
+            std::unordered_map<QueueHandle*, std::pair<QueueHandlePtr, std::vector<MessageId>>> groups;
+            std::vector<QueueHandle*> order;
+            for(auto& d : unacked)
+            {
+                if(d.consumer)  d.consumer->Release(d.bytes);
+                auto& group = groups[d.queue.get()];
+                if(!group.first)
+                {
+                    group.first = d.queue;
+                    order.push_back(d.queue.get());
+                }
+                group.second.push_back(d.id);
+            }
+            for(auto q : order)
+            {
+                auto& group = groups[q];
+                if(group.first->deleted)    continue;
+                size_t n = group.first->messages->Requeue(group.second);
+                LOG_DEBUG("信道 {} 关闭，{} 条未确认消息退回队列 {}", _cid, n, group.first->Name());
+                drain(_pool, group.first);
+            }
+        }
+
+        // 按队列分组，每个队列一次批量删除；归还额度后补投
+        void removeAcked(const std::vector<Delivery>& acked)
+        {
+            std::unordered_map<QueueHandle*, std::pair<QueueHandlePtr, std::vector<MessageId>>> groups;
+            for(auto& d : acked)
+            {
+                auto& group = groups[d.queue.get()];
+                group.first = d.queue;
+                group.second.push_back(d.id);
+                if(d.consumer)  d.consumer->Release(d.bytes);
+            }
+            for(auto& it : groups)
+            {
+                it.second.first->messages->Remove(it.second.second);
+                drain(it.second.first);
+            }
+        }
+
+        void sendConsumeResponse(const std::string& tag, const BasicProperties* bp, const std::string& body, uint64_t delivery_tag,
+                                 const MessageId* id = nullptr)
         {
             BasicConsumeResponse resp;
             resp.set_cid(_cid);
             resp.set_body(body);
             resp.set_consumer_tag(tag);
+            resp.set_delivery_tag(delivery_tag);
             if(bp)
             { 
-                resp.mutable_properties()->set_id(bp->id());
-                resp.mutable_properties()->set_delivery_mode(bp->delivery_mode());
-                resp.mutable_properties()->set_routing_key(bp->routing_key());
+                copyProperties(*bp, resp.mutable_properties(), id);
             }
             // LOG_DEBUG("向{}发送ConsumResponse", _conn->peerAddress().toIpPort());
             
             _codec->send(_conn, resp);
         }
 
-        void consume(const std::string& qname)
+        // 消息在进程内只带二进制 ID 时，在这里格式化成发给客户端的字符串
+        static void copyProperties(const BasicProperties& from, BasicProperties* to, const MessageId* id = nullptr)
+        {
+            if(from.id().empty() && id)
+                to->set_id(id->ToString());
+            else
+                to->set_id(from.id());
+            to->set_delivery_mode(from.delivery_mode());
+            to->set_routing_key(from.routing_key());
+            *to->mutable_headers() = from.headers();
+        }
+
+        // 从队列取至多 max_messages 条并应答；队列为空时只在 reply 为 true 时回复空结果。
+        // 只在队列的 strand 上调用，返回取到的条数
+        size_t pull(const QueueHandlePtr& queue, const BasicGetRequest& req, bool reply)
         {
-            auto mp = _host->BasicConsume(qname);
-            if(!mp.get())
+            if(_unacked.Closed())   return 0;
+            BasicGetResponse resp;
+            resp.set_rid(req.rid());
+            resp.set_cid(_cid);
+            resp.set_ok(true);
+            std::vector<MessageId> ids;
+            uint32_t max = std::max(1u, req.max_messages());
+            for(uint32_t i = 0; i < max; ++i)
             {
-                LOG_DEBUG("消费任务执行失败：{} 没有信息");
-                return;
+                MessageId id;
+                auto mp = queue->messages->Front(&id);
+                if(!mp.get())   break;
+                uint64_t tag = 0;
+                if(!req.no_ack() && (tag = _unacked.Push(queue, mp, id)) == 0)
+                {
+                    // 信道正在关闭：此前登记的消息由关闭流程退回
+                    queue->messages->Requeue({id});
+                    drain(_pool, queue);
+                    return 0;
+                }
+                auto& payload = mp->payload();
+                auto entry = resp.add_entries();
+                entry->set_body(payload.body());
+                copyProperties(payload.properties(), entry->mutable_properties(), &id);
+                if(req.no_ack())    ids.push_back(id);
+                else                entry->set_delivery_tag(tag);
             }
-            auto cp = _cmp->Choose(qname);
-            if(!cp.get())
+            if(req.no_ack() && _unacked.Closed())
             {
-                LOG_DEBUG("消费任务执行失败：{} 队列没有消费者", qname);
+                queue->messages->Requeue(ids);
+                drain(_pool, queue);
+                return 0;
+            }
+            if(resp.entries_size() == 0 && !reply)  return 0;
+
+            _codec->send(_conn, resp);
+            if(!ids.empty())    queue->messages->Remove(ids);
+            return resp.entries_size();
+        }
+
+        void getResponse(const std::string& rid, bool ok)
+        {
+            BasicGetResponse resp;
+            resp.set_rid(rid);
+            resp.set_cid(_cid);
+            resp.set_ok(ok);
+            _codec->send(_conn, resp);
+        }
+
+        // 按到达顺序满足等待中的拉取请求，已超时的跳过
+        static void serveGetters(const QueueHandlePtr& queue)
+        {
+            while(!queue->getters.empty() && queue->messages->GetTableCount() > 0)
+            {
+                auto waiter = std::move(queue->getters.front());
+                queue->getters.pop_front();
+                if(!waiter->done.exchange(true))
+                    waiter->serve(queue);
+            }
+        }
+
+        // 丢弃已超时的拉取请求；只在队列的 strand 上调用
+        static void pruneGetters(const QueueHandlePtr& queue)
+        {
+            std::erase_if(queue->getters, [](const GetWaiterPtr& waiter) { return waiter->done.load(); });
+        }
+
+        // 发布路径上的预判：非持久化队列为空且有消费者时才值得尝试直通
+        static bool mayHandoff(const QueueHandlePtr& queue)
+        {
+            return !queue->meta->durable && !queue->deleted.load(std::memory_order_acquire) &&
+                   queue->messages->GetTableCount() == 0 && !queue->consumers->Empty();
+        }
+
+        // 单条发布：可能直通，或已有直通任务在 strand 上排队时，入队也转到 strand 上完成，
+        // 保证同一队列的消息不会越过排在前面的直通消息
+        void publishOne(const QueueHandlePtr& queue, BasicProperties* bp, const std::string& body,
+                        std::function<void(bool)> done)
+        {
+            if(queue->handoff_pending.load() == 0 && !mayHandoff(queue))
+                return done(enqueue(queue, bp, body));
+
+            ++queue->handoff_pending;
+            auto self = shared_from_this();
+            queue->strand->Post(_pool, [self, queue, bp, &body, done = std::move(done)] {
+                bool ok = handoff(queue, bp, body) || self->enqueue(queue, bp, body);
+                --queue->handoff_pending;
+                done(ok);
+            });
+        }
+
+        bool enqueue(const QueueHandlePtr& queue, BasicProperties* bp, const std::string& body)
+        {
+            if(!_host->BasicPublish(queue, bp, body))   return false;
+            drain(queue);
+            return true;
+        }
+
+        // 直通投递：在队列的 strand 上执行。队列为空、没有等待的拉取请求且有消费者有额度时直接交给它，
+        // 消息只登记在待确认表中，不进入待投递队列，也不经过 Front 与投递循环
+        static bool handoff(const QueueHandlePtr& queue, const BasicProperties* bp, const std::string& body)
+        {
+            if(queue->meta->durable || queue->deleted.load(std::memory_order_acquire))
+                return false;
+            pruneGetters(queue);
+            if(!queue->getters.empty() || queue->messages->GetTableCount() > 0)
+                return false;
+
+            auto cp = queue->consumers->Choose();
+            if(!cp.get())   return false;
+            MessageId id;
+            MyMessagePtr msg;
+            if(cp->deliver)
+                msg = queue->messages->InsertUnacked(bp, body, id);
+            if(!msg.get())
+            {
+                cp->Refund();
+                return false;
+            }
+            cp->deliver(cp, queue, DeliveryBatch{{msg, id}});
+            return true;
+        }
+
+        // 先满足等待中的拉取请求，再在消费者还有预取额度时持续投递，直到队列取空、额度用完或达到 limit 条；
+        // 只在队列的 strand 上执行。达到 limit 时返回 false，由调用者重新安排
+        static bool consume(const QueueHandlePtr& queue, size_t limit)
+        {
+            serveGetters(queue);
+            for(size_t i = 0; i < limit; ++i)
+            {
+                // 先预占消费者额度再取消息，没有可用消费者时消息留在队列中
+                auto cp = queue->consumers->Choose();
+                if(!cp.get())
+                {
+                    LOG_DEBUG("消费任务结束：{} 没有可用的消费者", queue->Name());
+                    return true;
+                }
+                MessageId id;
+                auto mp = queue->messages->Front(&id);
+                if(!mp.get())
+                {
+                    cp->Refund();
+                    return true;
+                }
+                if(cp->deliver)
+                {
+                    // 消费者仍有额度时继续为它取消息，凑成一帧
+                    DeliveryBatch batch{{mp, id}};
+                    size_t bytes = mp->payload().body().size();
+                    while(batch.size() < cp->max_batch && i + 1 < limit &&
+                          (cp->max_batch_bytes == 0 || bytes < cp->max_batch_bytes) && cp->Acquire())
+                    {
+                        auto next = queue->messages->Front(&id);
+                        if(!next.get())
+                        {
+                            cp->Refund();
+                            break;
+                        }
+                        bytes += next->payload().body().size();
+                        batch.emplace_back(std::move(next), id);
+                        ++i;
+                    }
+                    cp->deliver(cp, queue, batch);
+                    continue;
+                }
+                // 回调按字符串 ID 确认，补上字符串形式
+                auto properties = mp->mutable_payload()->mutable_properties();
+                if(properties->id().empty())    properties->set_id(id.ToString());
+                cp->callback(cp->tag, properties, mp->payload().body());
+                if(cp->autoAck) queue->messages->Remove(id);
+            }
+            return false;
+        }
+
+        void drain(const QueueHandlePtr& queue)
+        {
+            drain(_pool, queue);
+        }
+
+        // 在队列的 strand 上安排一次投递；已有尚未开始的投递任务时合并。
+        // 每次最多投递 DRAIN_BATCH 条，积压较多的队列分多次执行，不会独占线程
+        static void drain(ThreadPool* pool, const QueueHandlePtr& queue)
+        {
+            static constexpr size_t DRAIN_BATCH = 256;
+            if(queue->drain_pending.exchange(true))
                 return;
+            queue->strand->Post(pool, [pool, queue] {
+                queue->drain_pending.store(false);
+                if(!consume(queue, DRAIN_BATCH))
+                    drain(pool, queue);
+            });
+        }
+
+        void submit(const QueueHandlePtr& queue, ShardedExecutor::Task task)
+        {
+            if(_executor)   _executor->Submit(queue->hash, std::move(task));
+            else            task();
+        }
+
+        // 发布请求都在网络线程上按到达顺序登记
+        PublishJobPtr newJob(const std::string& rid, uint64_t seq)
+        {
+            auto job = std::make_shared<PublishJob>();
+            job->rid = rid;
+            job->seq = seq;
+            job->ok = true;
+            job->remaining = 0;
+            std::unique_lock<std::mutex> lock(_pub_mutex);
+            job->index = _pub_next++;
+            return job;
+        }
+
+        void completeJob(const PublishJobPtr& job)
+        {
+            if(job->remaining.fetch_sub(1) == 1)
+                finishJob(job);
+        }
+
+        // 登记完成的发布，并按序发出所有前序都已完成的应答
+        void finishJob(const PublishJobPtr& job)
+        {
+            std::unique_lock<std::mutex> lock(_pub_mutex);
+            _pub_ready.emplace(job->index, job);
+            while(!_pub_ready.empty() && _pub_ready.begin()->first == _pub_done)
+            {
+                auto& done = _pub_ready.begin()->second;
+                publishResponse(done->ok, done->rid, done->seq);
+                _pub_ready.erase(_pub_ready.begin());
+                ++_pub_done;
             }
-            cp->callback(cp->tag, mp->mutable_payload()->mutable_properties(), mp->payload().body());
-            if(cp->autoAck) _host->BasicAck(qname, mp->payload().properties().id());
+        }
+
+        // 确认模式下回复发布确认，否则回复普通应答。
+        // 同一信道的发布按序处理，之前的序号都已确认，因此总是累计确认
+        void publishResponse(bool ok, const std::string& rid, uint64_t seq)
+        {
+            if(!_confirm)
+                return basicResponse(ok, rid, _cid);
+
+            BasicConfirmResponse resp;
+            resp.set_cid(_cid);
+            resp.set_seq(seq);
+            resp.set_multiple(true);
+            resp.set_ok(ok);
+            _codec->send(_conn, resp);
         }
 
         void basicResponse(const bool ok, const std::string& rid, const std::string& cid)
@@ -217,7 +819,8 @@ namespace MyMQ
                 const ConsumerManagerPtr& cmp,
                 const ProtobufCodecPtr& codec,
                 const muduo::net::TcpConnectionPtr& conn,
-                ThreadPool* pool)
+                ThreadPool* pool,
+                ShardedExecutor* executor = nullptr)
         {
             std::unique_lock<std::mutex> lock(_mutex);
 
@@ -227,15 +830,29 @@ namespace MyMQ
                 LOG_DEBUG("信道 {} 已经存在", cid);
                 return false;
             }
-            auto channel = std::make_shared<Channel>(cid, host, cmp, codec, conn, pool);
+            auto channel = std::make_shared<Channel>(cid, host, cmp, codec, conn, pool, executor);
             _channels.insert(std::make_pair(cid, channel));
             return true;
         }
 
+        // 连接断开时关闭全部信道，不必等仍持有信道的任务结束
+        ~ChannelManager()
+        {
+            for(auto& it : _channels)
+                it.second->Close();
+        }
+
         void CloseChannel(const std::string& cid)
         {
-            std::unique_lock<std::mutex> lock(_mutex);
-            _channels.erase(cid);
+            ChannelPtr channel;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                auto it = _channels.find(cid);
+                if(it == _channels.end())   return;
+                channel = std::move(it->second);
+                _channels.erase(it);
+            }
+            channel->Close();
         }
 
         ChannelPtr GetChannel(const std::string& cid)
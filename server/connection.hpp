@@ -20,17 +20,35 @@ namespace MyMQ
         ProtobufCodecPtr _codec;
         ThreadPool* _pool;
         ChannelManagerPtr _channels;
+        FlowControlPtr _flow;
+        ShardedExecutor* _executor;
+
+        // 流控状态
+        std::mutex _flow_mutex;
+        bool _publisher = false;    // 发布过消息，阻塞时暂停读取
+        bool _blocked = false;      // 已暂停读取
+        std::atomic<bool> _socket_alarm{false};   // 发送缓冲区超过水位
     public:
         Connection(const VirtualHostPtr& host,
                 const ConsumerManagerPtr& cmp,
+                const ProtobufCodecPtr& codec,
                 const muduo::net::TcpConnectionPtr& conn,
-                ThreadPool* pool)
-                :_host(host), _cmp(cmp), _conn(conn), _pool(pool), _channels(std::make_shared<ChannelManager>())
+                ThreadPool* pool,
+                const FlowControlPtr& flow = nullptr,
+                ShardedExecutor* executor = nullptr)
+                :_host(host), _cmp(cmp), _conn(conn), _codec(codec), _pool(pool),
+                _channels(std::make_shared<ChannelManager>()), _flow(flow), _executor(executor)
         {}
+
+        ~Connection()
+        {
+            if(_flow && _socket_alarm)
+                _flow->Alarm(socketSource(), false);
+        }
         
         void OpenChannel(const OpenChannelRequestPtr& req)
         {
-            bool ret = _channels->OpenChannel(req->cid(), _host, _cmp, _codec, _conn, _pool);
+            bool ret = _channels->OpenChannel(req->cid(), _host, _cmp, _codec, _conn, _pool, _executor);
             if(!ret)
             {
                 LOG_DEBUG("信道ID冲突:{}", req->cid());
@@ -50,7 +68,63 @@ namespace MyMQ
         {
             return _channels->GetChannel(cid);
         }
+
+        // 收到发布请求时调用：首次发布登记为发布者，流控阻塞中则立即暂停读取
+        void OnPublish()
+        {
+            if(!_flow)  return;
+            {
+                std::unique_lock<std::mutex> lock(_flow_mutex);
+                if(_publisher)  return;
+                _publisher = true;
+            }
+            if(_flow->Blocked())
+                Block(_flow->Reason());
+        }
+
+        // 只暂停发布者：纯消费者的连接仍需读取确认来释放内存
+        void Block(const std::string& reason)
+        {
+            {
+                std::unique_lock<std::mutex> lock(_flow_mutex);
+                if(!_publisher || _blocked) return;
+                _blocked = true;
+            }
+            ConnectionBlocked frame;
+            frame.set_reason(reason);
+            _codec->send(_conn, frame);
+            _conn->stopRead();
+        }
+
+        void Unblock()
+        {
+            {
+                std::unique_lock<std::mutex> lock(_flow_mutex);
+                if(!_blocked)   return;
+                _blocked = false;
+            }
+            _conn->startRead();
+            _codec->send(_conn, ConnectionUnblocked());
+        }
+
+        // 发送缓冲区超过水位与写完成时调用
+        void OnHighWaterMark()
+        {
+            if(_flow && !_socket_alarm.exchange(true))
+                _flow->Alarm(socketSource(), true);
+        }
+
+        void OnWriteComplete()
+        {
+            if(_socket_alarm.load(std::memory_order_relaxed) && _socket_alarm.exchange(false))
+                _flow->Alarm(socketSource(), false);
+        }
     private:
+        std::string socketSource() const
+        {
+            return "socket:" + _conn->peerAddress().toIpPort();
+        }
+
         void basicResponse(bool ok, const std::string& rid, const std::string& cid) const
         {
             BasicCommonResponse resp;
@@ -74,25 +148,52 @@ namespace MyMQ
                 const ConsumerManagerPtr& cmp,
                 const ProtobufCodecPtr& codec,
                 const muduo::net::TcpConnectionPtr& conn,
-                ThreadPool* pool)  //TODO const？
+                ThreadPool* pool,
+                const FlowControlPtr& flow = nullptr,
+                ShardedExecutor* executor = nullptr)  //TODO const？
         {
             std::unique_lock<std::mutex> lock(_mutex);
             auto it = _conns.find(conn);
             if(it != _conns.end())
                 return;
-            auto cp = std::make_shared<Connection>(host, cmp, conn, pool);
+            auto cp = std::make_shared<Connection>(host, cmp, codec, conn, pool, flow, executor);
             _conns.insert(std::make_pair(conn, cp));
         }
         
+        // 连接在锁外析构：析构时解除套接字告警，流控回调会再进入 SetBlocked
         void DeleteConnection(const muduo::net::TcpConnectionPtr& conn)
         {
-            std::unique_lock<std::mutex> lock(_mutex);
-            _conns.erase(conn);
+            ConnectionPtr cp;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                auto it = _conns.find(conn);
+                if(it == _conns.end())  return;
+                cp = std::move(it->second);
+                _conns.erase(it);
+            }
         }
 
         ConnectionPtr GetConnection(const muduo::net::TcpConnectionPtr& conn)
         {
-            return _conns.contains(conn) ? _conns[conn] : ConnectionPtr();
+            std::unique_lock<std::mutex> lock(_mutex);
+            auto it = _conns.find(conn);
+            return it == _conns.end() ? ConnectionPtr() : it->second;
+        }
+
+        // 流控状态变化时通知所有连接
+        void SetBlocked(bool blocked, const std::string& reason)
+        {
+            std::vector<ConnectionPtr> conns;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                for(auto& it : _conns)
+                    conns.push_back(it.second);
+            }
+            for(auto& cp : conns)
+            {
+                if(blocked) cp->Block(reason);
+                else        cp->Unblock();
+            }
         }
     };
 }
\ No newline at end of file
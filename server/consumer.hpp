@@ -5,18 +5,36 @@
 #pragma once
 
 #include "help.hpp"
+#include <algorithm>
+#include <atomic>
 #include <functional>
+#include <random>
 
 namespace MyMQ
 {
     struct Consumer;
     class QueueConsumer;
     class ConsumerManager;
+    struct QueueHandle;
 
     using ConsumerPtr = std::shared_ptr<Consumer>;
     using QueueConsumerPtr = std::shared_ptr<QueueConsumer>;
     using ConsumerManagerPtr = std::shared_ptr<ConsumerManager>;
     using ConsumerCallback = std::function<void(const std::string tag, const BasicProperties* properties, const std::string& msg) >;
+    // 一次投递给同一消费者的消息：(消息, 消息 ID)
+    using DeliveryBatch = std::vector<std::pair<std::shared_ptr<Message>, MessageId>>;
+    // 投递回调：由所属信道登记投递标签后再推送，未设置时退回 callback
+    using DeliverCallback = std::function<void(const ConsumerPtr& consumer, const std::shared_ptr<QueueHandle>& queue,
+                                               const DeliveryBatch& batch)>;
+
+    // 消费者的预取与批量投递限制，创建时一并设置，消费者对投递任务可见前即已生效
+    struct ConsumerLimits
+    {
+        uint32_t prefetch_count = 0;    // 0 表示不限制
+        uint32_t prefetch_size = 0;
+        uint32_t max_batch = 1;
+        uint32_t max_batch_bytes = 0;
+    };
 
     struct Consumer
     {
@@ -24,6 +42,19 @@ namespace MyMQ
         std::string qname;
         bool autoAck;
         ConsumerCallback callback;
+        DeliverCallback deliver;
+
+        // 预取额度：手动确认的消费者未确认的条数与字节数，上限为 0 表示不限制
+        std::atomic<uint32_t> prefetch_count{0};
+        std::atomic<uint32_t> prefetch_size{0};
+        std::atomic<uint32_t> unacked{0};
+        std::atomic<uint64_t> unacked_bytes{0};
+
+        int32_t priority = 0;   // x-priority，仅在 priority 策略下生效
+
+        // 一次投递的条数与消息体字节数上限（max_batch_bytes 为 0 表示不限制）
+        uint32_t max_batch = 1;
+        uint32_t max_batch_bytes = 0;
 
         Consumer() {
             LOG_DEBUG("new Consumer:{}", static_cast<void*>(this));
@@ -33,36 +64,107 @@ namespace MyMQ
             LOG_DEBUG("delete Consumer: {}", static_cast<void*>(this));
         }
 
-        Consumer(const std::string& tag, const std::string& qname, const bool autoAck, const ConsumerCallback& callback)
-            :tag(tag), qname(qname), autoAck(autoAck), callback(callback) {
+        Consumer(const std::string& tag, const std::string& qname, const bool autoAck, const ConsumerCallback& callback,
+                 const DeliverCallback& deliver = {}, const ConsumerLimits& limits = {})
+            :tag(tag), qname(qname), autoAck(autoAck), callback(callback), deliver(deliver),
+            prefetch_count(limits.prefetch_count), prefetch_size(limits.prefetch_size),
+            max_batch(std::max(1u, limits.max_batch)), max_batch_bytes(limits.max_batch_bytes) {
             LOG_DEBUG("new Consumer(args):{}", static_cast<void*>(this));
         }
+
+        // 预占一条投递的额度；自动确认的消费者不受限制
+        bool Acquire()
+        {
+            if(autoAck) return true;
+            uint32_t size = prefetch_size.load(std::memory_order_relaxed);
+            if(size && unacked_bytes.load(std::memory_order_relaxed) >= size)
+                return false;
+            uint32_t count = prefetch_count.load(std::memory_order_relaxed);
+            uint32_t cur = unacked.load(std::memory_order_relaxed);
+            do
+            {
+                if(count && cur >= count)   return false;
+            } while(!unacked.compare_exchange_weak(cur, cur + 1, std::memory_order_relaxed));
+            return true;
+        }
+
+        // 预占后没有取到消息，退还额度
+        void Refund()
+        {
+            if(!autoAck)    unacked.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        // 投递后计入消息体字节数
+        void Charge(size_t bytes)
+        {
+            if(!autoAck)    unacked_bytes.fetch_add(bytes, std::memory_order_relaxed);
+        }
+
+        // 确认后归还额度
+        void Release(size_t bytes)
+        {
+            if(autoAck) return;
+            unacked.fetch_sub(1, std::memory_order_relaxed);
+            unacked_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+        }
     };
 
+    // 队列选择消费者的策略，由队列参数 x-consumer-strategy 指定
+    enum class ConsumerStrategy
+    {
+        ROUND_ROBIN,        // round-robin：轮转
+        LEAST_UNACKED,      // least-unacked：未确认消息最少者
+        PRIORITY,           // priority：优先级高者优先（x-priority），同级轮转
+        POWER_OF_TWO,       // power-of-two：随机取两个，选未确认较少者
+    };
+
+    inline ConsumerStrategy ParseConsumerStrategy(const std::string& name)
+    {
+        if(name == "least-unacked")  return ConsumerStrategy::LEAST_UNACKED;
+        if(name == "priority")       return ConsumerStrategy::PRIORITY;
+        if(name == "power-of-two")   return ConsumerStrategy::POWER_OF_TWO;
+        return ConsumerStrategy::ROUND_ROBIN;
+    }
+
     class QueueConsumer
     {
     private:
         #define LOCK(mtx) std::unique_lock<std::mutex> lock(mtx)
 
+        // 消费者列表的只读快照，按优先级从高到低稳定排序；groups[i] 为第 i 个优先级分组的起始下标
+        struct ConsumerList
+        {
+            std::vector<ConsumerPtr> consumers;
+            std::vector<size_t> groups;
+        };
+        using ConsumerListPtr = std::shared_ptr<const ConsumerList>;
+
         std::string _qname;
-        std::mutex _mutex;
-        uint64_t _rrSeq ;    //轮转号？
-        std::vector<ConsumerPtr> _consumers;
+        ConsumerStrategy _strategy = ConsumerStrategy::ROUND_ROBIN;
+        std::mutex _mutex;          // 只串行化写者；Choose 只做一次原子读取
+        std::atomic<uint64_t> _rrSeq{0};    // 轮转号
+        std::atomic<ConsumerListPtr> _snapshot{std::make_shared<const ConsumerList>()};
     public:
         QueueConsumer() = default;
 
-        explicit QueueConsumer(const std::string& qname) :_qname(qname), _rrSeq(0) {}
+        explicit QueueConsumer(const std::string& qname, ConsumerStrategy strategy = ConsumerStrategy::ROUND_ROBIN)
+            :_qname(qname), _strategy(strategy) {}
 
-        ConsumerPtr Create(const std::string & ctag, const std::string& qname, const bool autoAck, const ConsumerCallback& callback)
+        ConsumerPtr Create(const std::string & ctag, const std::string& qname, const bool autoAck, const ConsumerCallback& callback,
+                           const DeliverCallback& deliver = {}, int32_t priority = 0, const ConsumerLimits& limits = {})
         {
             LOCK(_mutex);
-            for(auto& it : _consumers)
+            auto snap = _snapshot.load();
+            for(auto& it : snap->consumers)
             {
                 if(ctag == it->tag) return {};
             }
 
-            auto consumer = std::make_shared<Consumer>(ctag, qname, autoAck, callback);
-            _consumers.push_back(consumer);
+            auto consumer = std::make_shared<Consumer>(ctag, qname, autoAck, callback, deliver, limits);
+            consumer->priority = priority;
+            auto consumers = snap->consumers;
+            consumers.push_back(consumer);
+            publish(std::move(consumers));
 
             return consumer;
         }
@@ -70,32 +172,54 @@ namespace MyMQ
         void Remove(const std::string & ctag)
         {
             LOCK(_mutex);
-            for(auto it = _consumers.begin(); it != _consumers.end(); ++it)
+            auto consumers = _snapshot.load()->consumers;
+            for(auto it = consumers.begin(); it != consumers.end(); ++it)
             {
                 if((*it)->tag == ctag)
                 {
-                    _consumers.erase(it);
+                    consumers.erase(it);
+                    publish(std::move(consumers));
                     break;
                 }
             }
         }
 
+        // 按队列的策略选择一个仍有预取额度的消费者，并预占一条额度；都没有额度时返回空
         ConsumerPtr Choose()
         {
-            LOCK(_mutex);
-            if(_consumers.empty())  return {};
+            auto snap = _snapshot.load();
+            auto& consumers = snap->consumers;
+            if(consumers.empty())   return {};
 
-            int index = _rrSeq % _consumers.size();
-            _rrSeq++;
-            // LOG_DEBUG("index:{} _consumers.size:{}", index, _consumers.size());
-
-            return _consumers[index];
+            switch(_strategy)
+            {
+            case ConsumerStrategy::LEAST_UNACKED:
+                return chooseLeastUnacked(consumers);
+            case ConsumerStrategy::PRIORITY:
+                // 高优先级分组都没有额度时才轮到下一级
+                for(size_t g = 0; g < snap->groups.size(); ++g)
+                {
+                    size_t end = g + 1 < snap->groups.size() ? snap->groups[g + 1] : consumers.size();
+                    if(auto cp = chooseRoundRobin(consumers, snap->groups[g], end))
+                        return cp;
+                }
+                return {};
+            case ConsumerStrategy::POWER_OF_TWO:
+                if(auto cp = choosePowerOfTwo(consumers))
+                    return cp;
+                break;
+            default:
+                break;
+            }
+            return chooseRoundRobin(consumers, 0, consumers.size());
         }
 
+        ConsumerStrategy Strategy() const { return _strategy; }
+
         bool Exists(const std::string & tag)
         {
-            LOCK(_mutex);
-            for(auto& it : _consumers)
+            auto snap = _snapshot.load();
+            for(auto& it : snap->consumers)
             {
                 if(it->tag == tag)
                     return true;
@@ -106,17 +230,88 @@ namespace MyMQ
 
         bool Empty()
         {
-            LOCK(_mutex);
-            return true;
+            return _snapshot.load()->consumers.empty();
         }
 
 
         void Clear()
         {
             LOCK(_mutex);
-            _consumers.clear();
+            publish({});
             _rrSeq = 0;
         }
+
+    private:
+        // 在 _mutex 下生成并发布新快照
+        void publish(std::vector<ConsumerPtr> consumers)
+        {
+            auto next = std::make_shared<ConsumerList>();
+            if(_strategy == ConsumerStrategy::PRIORITY)
+            {
+                std::stable_sort(consumers.begin(), consumers.end(), [](const ConsumerPtr& a, const ConsumerPtr& b) {
+                    return a->priority > b->priority;
+                });
+                for(size_t i = 0; i < consumers.size(); ++i)
+                {
+                    if(i == 0 || consumers[i]->priority != consumers[i - 1]->priority)
+                        next->groups.push_back(i);
+                }
+            }
+            next->consumers = std::move(consumers);
+            _snapshot.store(std::move(next));
+        }
+
+        // 从轮转位置开始取 [begin, end) 中第一个有额度的消费者；通常第一个就满足
+        ConsumerPtr chooseRoundRobin(const std::vector<ConsumerPtr>& consumers, size_t begin, size_t end)
+        {
+            size_t n = end - begin;
+            if(n == 0)  return {};
+            uint64_t seq = _rrSeq.fetch_add(1, std::memory_order_relaxed);
+            for(size_t i = 0; i < n; ++i)
+            {
+                auto& cp = consumers[begin + (seq + i) % n];
+                if(cp->Acquire())
+                {
+                    _rrSeq.store(seq + i + 1, std::memory_order_relaxed);
+                    return cp;
+                }
+            }
+            return {};
+        }
+
+        // 扫描一遍快照，取未确认消息最少的消费者；预占失败（被并发占满）时退回轮转
+        ConsumerPtr chooseLeastUnacked(const std::vector<ConsumerPtr>& consumers)
+        {
+            const ConsumerPtr* best = nullptr;
+            uint32_t least = UINT32_MAX;
+            for(auto& cp : consumers)
+            {
+                uint32_t unacked = cp->unacked.load(std::memory_order_relaxed);
+                if(unacked < least)
+                {
+                    least = unacked;
+                    best = &cp;
+                }
+            }
+            if(best && (*best)->Acquire())  return *best;
+            return chooseRoundRobin(consumers, 0, consumers.size());
+        }
+
+        // 随机取两个不同的消费者，选未确认较少且有额度的一个
+        ConsumerPtr choosePowerOfTwo(const std::vector<ConsumerPtr>& consumers)
+        {
+            size_t n = consumers.size();
+            if(n == 1)  return consumers[0]->Acquire() ? consumers[0] : ConsumerPtr();
+
+            thread_local std::mt19937_64 rng(std::random_device{}());
+            size_t a = rng() % n;
+            size_t b = (a + 1 + rng() % (n - 1)) % n;
+            if(consumers[b]->unacked.load(std::memory_order_relaxed) < consumers[a]->unacked.load(std::memory_order_relaxed))
+                std::swap(a, b);
+            if(consumers[a]->Acquire()) return consumers[a];
+            if(consumers[b]->Acquire()) return consumers[b];
+            return {};
+        }
     };
 
     class ConsumerManager
@@ -143,7 +338,7 @@ namespace MyMQ
     public:
         ConsumerManager() = default;
 
-        void InitQueueConsumer(const std::string& qname)
+        void InitQueueConsumer(const std::string& qname, ConsumerStrategy strategy = ConsumerStrategy::ROUND_ROBIN)
         {
             LOCK(_mutex);
             auto it = _qconsumer.find(qname);
@@ -152,11 +347,20 @@ namespace MyMQ
                 LOG_DEBUG("消费者队列已存在:{}", qname);
                 return;
             }
-            auto qcp = std::make_shared<QueueConsumer>(qname);
+            auto qcp = std::make_shared<QueueConsumer>(qname, strategy);
             _qconsumer.insert(std::make_pair(qname, qcp));
         }
 
-        ConsumerPtr Create(const std::string& ctag, const std::string& qname, bool ackFlag, const ConsumerCallback& callback)
+        QueueConsumerPtr GetQueueConsumer(const std::string& qname)
+        {
+            LOCK(_mutex);
+            QueueConsumerPtr qcp;
+            findQueue(qname, qcp);
+            return qcp;
+        }
+
+        ConsumerPtr Create(const std::string& ctag, const std::string& qname, bool ackFlag, const ConsumerCallback& callback,
+                           const DeliverCallback& deliver = {}, int32_t priority = 0, const ConsumerLimits& limits = {})
         {
             QueueConsumerPtr qcp;
             {
@@ -166,7 +370,7 @@ namespace MyMQ
                 }
             }
 
-            return qcp->Create(ctag, qname, ackFlag, callback);
+            return qcp->Create(ctag, qname, ackFlag, callback, deliver, priority, limits);
         }
 
         void Remove(const std::string& ctag, const std::string& qname)
@@ -199,6 +403,7 @@ namespace MyMQ
             {
                 LOCK(_mutex);
                 if(!findQueue(qname, qcp)) {
+                    return {};
                 }
             }
 
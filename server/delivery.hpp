@@ -0,0 +1,163 @@
+#pragma once
+
+#include "queue.hpp"
+#include <deque>
+#include <vector>
+
+// 信道的未确认投递窗口：投递时按信道分配递增的 64 位投递标签，
+// 窗口起点为最小的未确认标签，确认时用 标签-起点 直接定位
+namespace MyMQ
+{
+    struct Delivery
+    {
+        QueueHandlePtr queue;
+        MyMessagePtr msg;
+        MessageId id;
+        ConsumerPtr consumer;   // 确认后归还其预取额度
+        size_t bytes = 0;
+        bool acked = false;
+    };
+
+    class DeliveryWindow
+    {
+    private:
+        std::mutex _mutex;
+        uint64_t _base = 1;             // _window[0] 的投递标签
+        std::deque<Delivery> _window;
+        size_t _unacked = 0;
+        bool _closed = false;           // TakeAll 之后不再登记新的投递
+
+    public:
+        // 登记一次投递，返回投递标签；窗口已关闭时返回 0，由调用者把消息退回队列
+        uint64_t Push(const QueueHandlePtr& queue, const MyMessagePtr& msg, const MessageId& id,
+                      const ConsumerPtr& consumer = nullptr)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            if(_closed) return 0;
+            _window.push_back(Delivery{queue, msg, id, consumer, msg->payload().body().size(), false});
+            ++_unacked;
+            return _base + _window.size() - 1;
+        }
+
+        // 确认单个标签；标签不在窗口内或已确认返回 false
+        bool Ack(uint64_t tag, Delivery& out)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            if(tag < _base || tag - _base >= _window.size())
+                return false;
+
+            Delivery& d = _window[tag - _base];
+            if(d.acked) return false;
+            out = d;
+            release(d);
+            slide();
+            return true;
+        }
+
+        // 按消息 ID 确认（兼容旧客户端只带 message_id 的确认）；只在窗口内线性查找，找不到返回 false
+        bool AckId(const MessageId& id, Delivery& out)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            for(auto& d : _window)
+            {
+                if(d.acked || !(d.id == id))    continue;
+                out = d;
+                release(d);
+                slide();
+                return true;
+            }
+            return false;
+        }
+
+        // 确认 tag 及之前所有未确认的投递，返回确认的个数
+        size_t AckUpTo(uint64_t tag, std::vector<Delivery>& out)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            size_t n = 0;
+            while(!_window.empty() && _base <= tag)
+            {
+                Delivery& d = _window.front();
+                if(!d.acked)
+                {
+                    out.push_back(d);
+                    release(d);
+                    ++n;
+                }
+                _window.pop_front();
+                ++_base;
+            }
+            return n;
+        }
+
+        // 确认闭区间 [first, last] 内未确认的投递，返回确认的个数
+        size_t AckRange(uint64_t first, uint64_t last, std::vector<Delivery>& out)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            if(first < _base)   first = _base;
+            uint64_t end = _base + _window.size();
+            if(last >= end)     last = end - 1;
+
+            size_t n = 0;
+            for(uint64_t tag = first; tag <= last && tag < end; ++tag)
+            {
+                Delivery& d = _window[tag - _base];
+                if(d.acked)  continue;
+                out.push_back(d);
+                release(d);
+                ++n;
+            }
+            slide();
+            return n;
+        }
+
+        // 取出全部未确认的投递（按投递顺序）并关闭窗口，用于信道关闭时退回队列
+        size_t TakeAll(std::vector<Delivery>& out)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _closed = true;
+            size_t n = 0;
+            for(auto& d : _window)
+            {
+                if(d.acked) continue;
+                out.push_back(std::move(d));
+                ++n;
+            }
+            _base += _window.size();
+            _window.clear();
+            _unacked = 0;
+            return n;
+        }
+
+        bool Closed()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            return _closed;
+        }
+
+        size_t Unacked()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            return _unacked;
+        }
+
+    private:
+        void release(Delivery& d)
+        {
+            d.acked = true;
+            d.queue.reset();
+            d.msg.reset();
+            d.consumer.reset();
+            --_unacked;
+        }
+
+        // 丢弃窗口头部已确认的项
+        void slide()
+        {
+            while(!_window.empty() && _window.front().acked)
+            {
+                _window.pop_front();
+                ++_base;
+            }
+        }
+    };
+}
@@ -1,17 +1,15 @@
 #pragma once
 
-#include "help.hpp"
+#include "metastore.hpp"
 #include <memory>
+#include <atomic>
 #include <google/protobuf/map.h>
 
 // 交换机模块
 namespace MyMQ
 {
-    struct Exchange;
     class ExchangeManager;
 
-    using ExchangePtr = std::shared_ptr<Exchange>;
-    using ExchangeMap = std::unordered_map<std::string, ExchangePtr>;
     using ExchangeManagerPtr = std::shared_ptr<ExchangeManager>;
 
     struct Exchange 
@@ -38,7 +36,13 @@ namespace MyMQ
         {
             std::vector<std::string> sub_args;
             StrHelper::Split(sub_args, str_args, "&");
-        }                        
+            for (auto& str: sub_args)
+            {
+                size_t pos = str.find("=");
+                if(pos == std::string::npos)    continue;
+                args[str.substr(0, pos)] = str.substr(pos + 1);
+            }
+        }
 
         std::string GetArgs()
         {
@@ -58,12 +62,10 @@ namespace MyMQ
     class ExchangeMapper 
     {
     public:
-        ExchangeMapper(const std::string& dbfile)
-        :_sql_helper(dbfile)
+        // 与其他元数据共用同一个数据库连接，便于放在同一事务中
+        explicit ExchangeMapper(const SqliteHelperPtr& helper)
+        :_sql_helper(helper)
         {
-            std::string path = FileHelper::ParentDirectory(dbfile);
-            FileHelper::CreateDirectory(path);
-            assert(_sql_helper.Open());
             CreateTable();
         }
 
@@ -76,7 +78,7 @@ namespace MyMQ
             auto_delete int, \
             args varchar(128));"
 
-            bool ret = _sql_helper.Exec(CREATE_TABLE, nullptr, nullptr);
+            bool ret = _sql_helper->Exec(CREATE_TABLE, nullptr, nullptr);
             if (ret == false)
             {
                 LOG_CRITICAL("创建交换机数据库表失败!!");
@@ -87,7 +89,7 @@ namespace MyMQ
         void RemoveTable()
         {
             #define DROP_TABLE "drop table if exists exchange_table;"
-            bool ret = _sql_helper.Exec(DROP_TABLE, nullptr, nullptr);
+            bool ret = _sql_helper->Exec(DROP_TABLE, nullptr, nullptr);
             if(ret == false)
             {
                 LOG_CRITICAL("删除交换机数据表失败！");
@@ -95,7 +97,7 @@ namespace MyMQ
             }
         }
 
-        bool Insert(ExchangePtr& exp)
+        bool Insert(const ExchangePtr& exp)
         {
             std::stringstream ss;
             ss << "insert into exchange_table values(";
@@ -105,7 +107,7 @@ namespace MyMQ
             ss << exp->auto_delete << ", ";
             ss << "'" << exp->GetArgs() << "');";
 
-            return _sql_helper.Exec(ss.str(), nullptr, nullptr);
+            return _sql_helper->Exec(ss.str(), nullptr, nullptr);
         }
 
         void Remove(const std::string& name)
@@ -113,14 +115,14 @@ namespace MyMQ
             std::stringstream ss;
             ss << "delete from exchange_table where name=";
             ss << "'" << name << "';";
-            _sql_helper.Exec(ss.str(), nullptr, nullptr);
+            _sql_helper->Exec(ss.str(), nullptr, nullptr);
         }
 
         ExchangeMap Recovery()
         {
             ExchangeMap result;
             std::string sql = "select name, type, durable, auto_delete, args from exchange_table;";
-            _sql_helper.Exec(sql, selectCallback, &result);
+            _sql_helper->Exec(sql, selectCallback, &result);
             return result;  
         }
 
@@ -139,18 +141,19 @@ namespace MyMQ
         }
 
     private:
-        SqliteHelper _sql_helper;
+        SqliteHelperPtr _sql_helper;
     };
 
 
     // 交换机数据内存管理类
+    // 读多写少：写者在 _mutex 下复制并替换快照，SelectExchange 等读操作只做原子读取
     class ExchangeManager 
     {
     public:
-        ExchangeManager(const std::string& dbfile)
-        :_mapper(dbfile)
+        explicit ExchangeManager(const MetaStorePtr& store)
+        :_store(store)
         {
-            _exchanges = _mapper.Recovery();
+            _exchanges.store(std::make_shared<const ExchangeMap>(_store->RecoveryExchanges()));
         }
 
         bool DeclareExchange(const std::string& name,
@@ -158,67 +161,72 @@ namespace MyMQ
             const google::protobuf::Map<std::string, std::string>& args)
         {
             std::unique_lock<std::mutex> lock(_mutex);
-            auto it = _exchanges.find(name);
-            if(it != _exchanges.end())
+            auto snap = _exchanges.load();
+            if(snap->contains(name))
                 return true;
             
             auto exp = std::make_shared<Exchange>(name, type, durable, auto_delete, args);
             if (durable == true)
             {
-                bool ret = _mapper.Insert(exp);
+                bool ret = _store->InsertExchange(exp);
                 if(ret == false) return false;
             }
 
-            _exchanges.insert(std::make_pair(name, exp));
+            auto next = std::make_shared<ExchangeMap>(*snap);
+            next->insert(std::make_pair(name, exp));
+            _exchanges.store(std::move(next));
             return true;
         }
 
-        void DeleteExchange(const std::string& name)
+        // persist 为 false 时只删除内存中的交换机，用于事务回滚后撤销内存状态
+        void DeleteExchange(const std::string& name, bool persist = true)
         {
             std::unique_lock<std::mutex> lock(_mutex);
-            auto it = _exchanges.find(name);
-            if(it == _exchanges.end())  return;
+            auto snap = _exchanges.load();
+            auto it = snap->find(name);
+            if(it == snap->end())  return;
             
-            if(it->second->durable == true) _mapper.Remove(name);
-            _exchanges.erase(name);
+            if(persist && it->second->durable == true) _store->RemoveExchange(name);
+            auto next = std::make_shared<ExchangeMap>(*snap);
+            next->erase(name);
+            _exchanges.store(std::move(next));
         }
 
         ExchangePtr SelectExchange(const std::string& name)
         {
-            std::unique_lock<std::mutex> lock(_mutex);
-            auto it = _exchanges.find(name);
-            if (it == _exchanges.end())
+            auto snap = _exchanges.load();
+            auto it = snap->find(name);
+            if (it == snap->end())
                 return ExchangePtr();
 
             return it->second;
         }
 
-        bool Exists(const std::string& name)
+        ExchangeMap AllExchanges()
         {
-            std::unique_lock<std::mutex> lock(_mutex);
-            auto it = _exchanges.find(name);
-            if (it == _exchanges.end())
-                return false;
+            return *_exchanges.load();
+        }
 
-            return true;
+        bool Exists(const std::string& name)
+        {
+            return _exchanges.load()->contains(name);
         }
 
         size_t Size()
         {
-            std::unique_lock<std::mutex> lock(_mutex);
-            return _exchanges.size();
+            return _exchanges.load()->size();
         }
 
         void Clear()
         {
             std::unique_lock<std::mutex> lock(_mutex);
-            _mapper.RemoveTable();
-            _exchanges.clear();
+            _store->ClearExchanges();
+            _exchanges.store(std::make_shared<const ExchangeMap>());
         }
 
     private:
         std::mutex _mutex;
-        ExchangeMapper _mapper;
-        ExchangeMap _exchanges;
+        MetaStorePtr _store;
+        std::atomic<std::shared_ptr<const ExchangeMap>> _exchanges;
     };
 }
\ No newline at end of file
@@ -0,0 +1,163 @@
+#pragma once
+
+#include "log.hpp"
+#include "threadpool.hpp"
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// 分片执行器：每个分片一个线程与一个 FIFO 任务队列，同一个键总是落在同一分片，
+// 因此同一键上的任务按提交顺序串行执行，不同键之间并行。
+// Strand：逻辑上的串行执行器，任务按提交顺序逐个执行，但不绑定线程，复用线程池中任意空闲线程
+namespace MyMQ
+{
+    class ShardedExecutor;
+    class Strand;
+
+    using ShardedExecutorPtr = std::shared_ptr<ShardedExecutor>;
+    using StrandPtr = std::shared_ptr<Strand>;
+
+    class ShardedExecutor
+    {
+    public:
+        using Task = std::function<void()>;
+
+    private:
+        struct Shard
+        {
+            std::mutex mutex;
+            std::condition_variable cv;
+            std::deque<Task> tasks;
+            bool stop = false;
+            std::thread thread;
+        };
+
+        std::vector<std::unique_ptr<Shard>> _shards;
+
+    public:
+        // n 为 0 时取硬件线程数
+        explicit ShardedExecutor(size_t n = 0)
+        {
+            if(n == 0)  n = std::max(1u, std::thread::hardware_concurrency());
+            for(size_t i = 0; i < n; ++i)
+            {
+                _shards.push_back(std::make_unique<Shard>());
+                Shard* shard = _shards.back().get();
+                shard->thread = std::thread([shard] { run(*shard); });
+            }
+        }
+
+        ~ShardedExecutor()
+        {
+            for(auto& shard : _shards)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(shard->mutex);
+                    shard->stop = true;
+                }
+                shard->cv.notify_one();
+            }
+            for(auto& shard : _shards)
+                shard->thread.join();
+        }
+
+        ShardedExecutor(const ShardedExecutor&) = delete;
+        ShardedExecutor& operator=(const ShardedExecutor&) = delete;
+
+        void Submit(size_t key, Task task)
+        {
+            Shard& shard = *_shards[key % _shards.size()];
+            {
+                std::unique_lock<std::mutex> lock(shard.mutex);
+                shard.tasks.push_back(std::move(task));
+            }
+            shard.cv.notify_one();
+        }
+
+        size_t Size() const { return _shards.size(); }
+
+    private:
+        // 停止后仍执行完已提交的任务
+        static void run(Shard& shard)
+        {
+            std::deque<Task> batch;
+            for(;;)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(shard.mutex);
+                    shard.cv.wait(lock, [&shard] { return shard.stop || !shard.tasks.empty(); });
+                    if(shard.tasks.empty()) return;
+                    batch.swap(shard.tasks);
+                }
+                for(auto& task : batch)
+                    task();
+                batch.clear();
+            }
+        }
+    };
+
+    class Strand : public std::enable_shared_from_this<Strand>
+    {
+    public:
+        using Task = std::function<void()>;
+
+    private:
+        static constexpr size_t BATCH = 64;    // 连续执行的任务数上限，之后让出线程
+
+        std::mutex _mutex;
+        std::deque<Task> _tasks;
+        bool _running = false;  // 已有线程在执行或已排入线程池
+
+    public:
+        // 提交任务；当前没有在执行时把自己排入 pool
+        void Post(ThreadPool* pool, Task task)
+        {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _tasks.push_back(std::move(task));
+                if(_running)    return;
+                _running = true;
+            }
+            schedule(pool);
+        }
+
+        size_t Pending()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            return _tasks.size();
+        }
+
+    private:
+        void schedule(ThreadPool* pool)
+        {
+            auto self = shared_from_this();
+            pool->enqueue([self, pool] { self->run(pool); });
+        }
+
+        void run(ThreadPool* pool)
+        {
+            for(size_t i = 0; i < BATCH; ++i)
+            {
+                Task task;
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    if(_tasks.empty())
+                    {
+                        _running = false;
+                        return;
+                    }
+                    task = std::move(_tasks.front());
+                    _tasks.pop_front();
+                }
+                task();
+            }
+            // 还有任务：重新排队，避免一个繁忙的队列长期占住线程
+            schedule(pool);
+        }
+    };
+}
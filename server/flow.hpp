@@ -0,0 +1,153 @@
+#pragma once
+
+#include "log.hpp"
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+
+// 流量控制：统计消息占用的内存，超过水位线时暂停读取发布者连接。
+// 三类告警：全局内存高于高水位；某个队列高于队列水位；某个连接的发送缓冲区高于套接字水位。
+// 任一告警存在即处于阻塞状态，全部解除后恢复；内存告警低于低水位才解除，避免来回抖动。
+// 阻塞是全局的：单个队列或单个连接的告警同样会暂停所有发布者连接，
+// 包括从未向该队列发布过的连接，直到告警解除
+namespace MyMQ
+{
+    class FlowControl;
+
+    using FlowControlPtr = std::shared_ptr<FlowControl>;
+
+    struct FlowOptions
+    {
+        size_t memory_high = 1024ul * 1024 * 1024;  // 全局内存高水位
+        size_t memory_low = 768ul * 1024 * 1024;    // 全局内存低水位
+        size_t queue_high = 256ul * 1024 * 1024;    // 单个队列的内存水位，超过时阻塞全部发布者，0 表示不限制
+        size_t socket_high = 64ul * 1024 * 1024;    // 连接发送缓冲区水位
+    };
+
+    class FlowControl
+    {
+    public:
+        // 阻塞状态变化时回调：blocked 为 true 时 reason 为告警原因
+        using BlockCallback = std::function<void(bool blocked, const std::string& reason)>;
+
+    private:
+        FlowOptions _options;
+        std::atomic<size_t> _used{0};
+        std::atomic<bool> _memory_alarm{false};
+
+        std::mutex _mutex;
+        std::unordered_set<std::string> _alarms;    // 队列与连接的告警源
+        bool _blocked = false;
+        bool _notified = false;     // 最近一次通知出去的状态
+        bool _notifying = false;    // 已有线程在执行回调
+        std::string _reason;
+        BlockCallback _callback;
+
+    public:
+        explicit FlowControl(const FlowOptions& options = FlowOptions()) :_options(options) {}
+
+        void SetCallback(const BlockCallback& cb)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _callback = cb;
+        }
+
+        void Add(size_t bytes)
+        {
+            size_t used = _used.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+            if(used >= _options.memory_high && !_memory_alarm.load(std::memory_order_relaxed))
+                update();
+        }
+
+        void Sub(size_t bytes)
+        {
+            size_t used = _used.fetch_sub(bytes, std::memory_order_relaxed) - bytes;
+            if(used <= _options.memory_low && _memory_alarm.load(std::memory_order_relaxed))
+                update();
+        }
+
+        // 设置或解除一个告警源，如 "queue:q1"、"socket:127.0.0.1:5000"
+        void Alarm(const std::string& source, bool on)
+        {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                bool changed = on ? _alarms.insert(source).second : _alarms.erase(source) > 0;
+                if(!changed)    return;
+                LOG_INFO("流控告警 {} {}", source, on ? "触发" : "解除");
+            }
+            update();
+        }
+
+        bool Blocked()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            return _blocked;
+        }
+
+        std::string Reason()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            return _reason;
+        }
+
+        size_t Used() const { return _used.load(std::memory_order_relaxed); }
+        size_t QueueHigh() const { return _options.queue_high; }
+        size_t SocketHigh() const { return _options.socket_high; }
+
+    private:
+        // 重新计算阻塞状态。回调在锁外执行，回调中可以再调用本对象或加其他锁；
+        // 同一时刻只有一个线程负责通知，它在返回前补发期间发生的变化，保证最后通知的是最新状态
+        void update()
+        {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                size_t used = _used.load(std::memory_order_relaxed);
+                bool memory = _memory_alarm.load(std::memory_order_relaxed);
+                if(!memory && used >= _options.memory_high)         memory = true;
+                else if(memory && used <= _options.memory_low)      memory = false;
+                _memory_alarm.store(memory, std::memory_order_relaxed);
+
+                bool blocked = memory || !_alarms.empty();
+                if(memory)
+                    _reason = "memory " + std::to_string(used) + " >= " + std::to_string(_options.memory_high);
+                else if(!_alarms.empty())
+                    _reason = *_alarms.begin();
+                else
+                    _reason.clear();
+                if(blocked != _blocked)
+                {
+                    _blocked = blocked;
+                    LOG_INFO("流控{}：{}", blocked ? "阻塞" : "恢复", _reason);
+                }
+                if(_notifying || _notified == _blocked)  return;
+                _notifying = true;
+            }
+            notify();
+        }
+
+        void notify()
+        {
+            for(;;)
+            {
+                bool blocked;
+                std::string reason;
+                BlockCallback callback;
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    if(_notified == _blocked)
+                    {
+                        _notifying = false;
+                        return;
+                    }
+                    _notified = blocked = _blocked;
+                    reason = _reason;
+                    callback = _callback;
+                }
+                if(callback)    callback(blocked, reason);
+            }
+        }
+    };
+}
@@ -1,9 +1,10 @@
 #pragma once
 
-#include "exchange.hpp"
-#include "binding.hpp"
+#include "sqlitestore.hpp"
+#include "journal.hpp"
 #include "message.hpp"
-#include "msgqueue.hpp"
+#include "queue.hpp"
+#include "mqproto.pb.h"
 
 namespace MyMQ
 {
@@ -16,24 +17,40 @@ namespace MyMQ
     private:
         std::string _hostname;
 
+        MetaStorePtr _meta;     // 交换机、队列、绑定共用的元数据存储
         ExchangeManagerPtr _emp;
         MsgQueueManagerPtr _mqmp;
         BindingManagerPtr _bmp;
         MessageManagerPtr _mmp;
+        ConsumerManagerPtr _cmp;
+
+        // 队列名 -> 句柄，写时复制，读取无锁
+        std::mutex _handle_mtx;
+        std::atomic<QueueHandleMapPtr> _handles;
         
     public:
-        VirtualHost(const std::string& hostname, const std::string& basedir, const std::string& dbfile)
+        VirtualHost(const std::string& hostname, const std::string& basedir, const std::string& dbfile,
+                    MetaBackend backend = MetaBackend::SQLITE, const ConsumerManagerPtr& cmp = nullptr,
+                    const FlowControlPtr& flow = nullptr)
         :_hostname(hostname),
-        _emp (std::make_shared<ExchangeManager>(dbfile)),
-        _mqmp (std::make_shared<MsgQueueManager>(dbfile)),
-        _bmp (std::make_shared<BindingManager>(dbfile)),
-        _mmp (std::make_shared<MessageManager>(basedir))
+        _meta (CreateMetaStore(backend, dbfile)),
+        _emp (std::make_shared<ExchangeManager>(_meta)),
+        _mqmp (std::make_shared<MsgQueueManager>(_meta)),
+        _bmp (std::make_shared<BindingManager>(_meta)),
+        _mmp (std::make_shared<MessageManager>(basedir, flow)),
+        _cmp (cmp ? cmp : std::make_shared<ConsumerManager>()),
+        _handles (std::make_shared<const QueueHandleMap>())
         {
             // 恢复历史数据
+            for(auto& it : _emp->AllExchanges())
+            {
+                _bmp->DeclareExchange(it.first, it.second->type);
+            }
             auto qm = _mqmp->AllQueues();
             for(auto& it : qm)
             {
                 _mmp->InitQueueManager(it.first);
+                _bmp->AttachQueue(it.first, openHandle(it.first));
             }
         }
 
@@ -57,7 +74,9 @@ namespace MyMQ
             ExchangeType type, bool durable, bool auto_delete,
             const google::protobuf::Map<std::string, std::string>& args)
         {
-            return _emp->DeclareExchange(name, type, durable, auto_delete, args);
+            bool ret = _emp->DeclareExchange(name, type, durable, auto_delete, args);
+            if(ret) _bmp->DeclareExchange(name, _emp->SelectExchange(name)->type);
+            return ret;
         }
         
         bool DeclareQueue(const std::string& qname,
@@ -67,18 +86,32 @@ namespace MyMQ
             const google::protobuf::Map<std::string, std::string>& args)
         {
             _mmp->InitQueueManager(qname);
-            return _mqmp->DeclareQueue(qname, qdurable, qexclusive, qauto_delete, args);
+            if(!_mqmp->DeclareQueue(qname, qdurable, qexclusive, qauto_delete, args))
+                return false;
+            openHandle(qname);
+            return true;
         }
 
 
         void DeleteQueue(const std::string& qname)
         {
+            closeHandle(qname);
             _mqmp->DeleteQueue(qname);
             _bmp->RemoveMsgQueueBindings(qname);
             _mmp->DestroyQueueMessage(qname);
+            _cmp->DestoryQueueConsumer(qname);
         }
 
-        bool Bind(const std::string& exchangeName, const std::string& queueName, const std::string& key)
+        // 声明队列后才有句柄；返回空表示队列不存在
+        QueueHandlePtr SelectQueueHandle(const std::string& qname)
+        {
+            auto handles = _handles.load();
+            auto it = handles->find(qname);
+            return it == handles->end() ? QueueHandlePtr() : it->second;
+        }
+
+        bool Bind(const std::string& exchangeName, const std::string& queueName, const std::string& key,
+                  const google::protobuf::Map<std::string, std::string>& args = {})
         {
             auto exp = _emp->SelectExchange(exchangeName);
             if(!exp.get())
@@ -86,13 +119,19 @@ namespace MyMQ
                 LOG_DEBUG("交换机没有队列：{}", exchangeName);
                 return false;
             }
-            auto mqp = _mqmp->SelectQueue(queueName);
-            if(!mqp.get())
+            auto handle = SelectQueueHandle(queueName);
+            if(!handle)
             {
                 LOG_DEBUG("没有信息队列：{}", queueName);
                 return false;
             }
-            return _bmp->Bind(exchangeName, queueName, key, exp->durable && mqp->durable);
+            uint32_t weight;
+            if(exp->type == ExchangeType::CONSISTENT_HASH && !Router::ParseWeight(key, weight))
+            {
+                LOG_DEBUG("一致性哈希交换机的绑定键须为权重：{}", key);
+                return false;
+            }
+            return _bmp->Bind(exchangeName, queueName, key, exp->durable && handle->meta->durable, args, handle);
         }
 
         void UnBind(const std::string& ExchangeName, const std::string& QueueName)
@@ -102,11 +141,95 @@ namespace MyMQ
             _bmp->UnBind(ExchangeName, QueueName);
         }
 
-        MsgQueueBindingMap ExchangeBindings(const std::string& ExchangeName)
+        // 批量声明交换机、队列与绑定：一个元数据事务，全部成功或全部回滚
+        bool DeclareTopology(const DeclareTopologyRequest& req)
+        {
+            std::vector<std::string> new_exchanges, new_queues;
+            std::vector<std::pair<std::string, std::string>> new_bindings;
+
+            if(!_meta->Begin())   return false;
+
+            bool ok = true;
+            for(auto& ex : req.exchanges())
+            {
+                bool exists = _emp->Exists(ex.exchange_name());
+                ok = DeclareExchange(ex.exchange_name(), ex.exchange_type(), ex.durable(), ex.auto_delete(), ex.args());
+                if(!ok) break;
+                if(!exists) new_exchanges.push_back(ex.exchange_name());
+            }
+
+            for(int i = 0; ok && i < req.queues_size(); ++i)
+            {
+                auto& q = req.queues(i);
+                bool exists = _mqmp->Exists(q.queue_name());
+                ok = DeclareQueue(q.queue_name(), q.durable(), q.exclusive(), q.auto_delete(), q.args());
+                if(!ok) break;
+                if(!exists) new_queues.push_back(q.queue_name());
+            }
+
+            for(int i = 0; ok && i < req.bindings_size(); ++i)
+            {
+                auto& b = req.bindings(i);
+                bool exists = _bmp->Exists(b.exchange_name(), b.queue_name());
+                ok = Bind(b.exchange_name(), b.queue_name(), b.binding_key(), b.args());
+                if(!ok) break;
+                if(!exists) new_bindings.emplace_back(b.exchange_name(), b.queue_name());
+            }
+
+            if(ok && _meta->Commit())
+                return true;
+
+            // 持久化数据只由 Rollback 撤销；之后只撤销本次新建的内存对象，不再写存储
+            LOG_DEBUG("批量声明失败，回滚：{} 个交换机，{} 个队列，{} 个绑定",
+                      new_exchanges.size(), new_queues.size(), new_bindings.size());
+            _meta->Rollback();
+            for(auto& it : new_bindings)   _bmp->UnBind(it.first, it.second, false);
+            for(auto& it : new_queues)
+            {
+                closeHandle(it);
+                _mqmp->DeleteQueue(it, false);
+                _mmp->DestroyQueueMessage(it);
+                _cmp->DestoryQueueConsumer(it);
+            }
+            for(auto& it : new_exchanges)
+            {
+                _bmp->RemoveExchangeBindings(it, false);
+                _emp->DeleteExchange(it, false);
+            }
+            return false;
+        }
+
+        ExchangeBindingsPtr ExchangeBindings(const std::string& ExchangeName)
         {
             return _bmp->GetExchangeBindings(ExchangeName);
         }
 
+        // 计算消息应投递到的绑定（队列）
+        BindingListPtr Route(const ExchangePtr& exp, const std::string& routingKey)
+        {
+            return _bmp->Route(exp->name, exp->type, routingKey);
+        }
+
+        BindingListPtr Route(const ExchangePtr& exp, const BasicProperties* bp)
+        {
+            static const BasicProperties empty;
+            if(exp->type == ExchangeType::HEADERS)
+            {
+                return _bmp->RouteHeaders(exp->name, bp ? bp->headers() : empty.headers());
+            }
+            if(exp->type == ExchangeType::CONSISTENT_HASH)
+            {
+                // 交换机参数 hash-header 指定按哪个头部哈希，缺省按路由键
+                const BasicProperties& props = bp ? *bp : empty;
+                auto hit = exp->args.find("hash-header");
+                if(hit == exp->args.end())
+                    return _bmp->RouteHash(exp->name, props.routing_key());
+                auto vit = props.headers().find(hit->second);
+                return _bmp->RouteHash(exp->name, vit == props.headers().end() ? std::string_view() : vit->second);
+            }
+            return Route(exp, bp ? bp->routing_key() : std::string());
+        }
+
         bool ExistBinding(const std::string& ename, const std::string& qname)
         {
             return _bmp->Exists(ename, qname);
@@ -115,38 +238,68 @@ namespace MyMQ
         // 发布信息
         bool BasicPublish(const std::string& qname, BasicProperties* bp,const std::string& body)
         {
-            auto mqp = _mqmp->SelectQueue(qname);
-            if(!mqp.get())
+            auto handle = SelectQueueHandle(qname);
+            if(!handle)
             {
                 LOG_DEBUG("发布信息失败，没有队列:{}", qname);
                 return false;
             }
-            return _mmp->Insert(qname, bp, body, mqp->durable);
+            return BasicPublish(handle, bp, body);
+        }
+
+        bool BasicPublish(const QueueHandlePtr& handle, BasicProperties* bp, const std::string& body)
+        {
+            if(handle->deleted.load(std::memory_order_acquire))
+            {
+                LOG_DEBUG("发布信息失败，队列已删除:{}", handle->Name());
+                return false;
+            }
+            return handle->messages->Insert(bp, body, handle->meta->durable);
+        }
+
+        // 批量发布到同一队列，返回成功插入的条数
+        size_t BasicPublish(const QueueHandlePtr& handle, const std::vector<MessageRef>& batch)
+        {
+            if(handle->deleted.load(std::memory_order_acquire))
+            {
+                LOG_DEBUG("发布信息失败，队列已删除:{}", handle->Name());
+                return 0;
+            }
+            return handle->messages->Insert(batch, handle->meta->durable);
         }
 
         bool BasicAck(const std::string& qname, const std::string& msgid)
         {
-            auto mqp = _mqmp->SelectQueue(qname);
-            if(!mqp.get())
+            auto handle = SelectQueueHandle(qname);
+            if(!handle)
             {
                 LOG_DEBUG("确定队列信息失败：{}", qname);
                 return false;
             }
 
-            return _mmp->Ack(qname, msgid);
+            return handle->messages->Remove(msgid);
         }
 
         MyMessagePtr BasicConsume(const std::string& qname)
         {
-            return _mmp->Front(qname);
+            auto handle = SelectQueueHandle(qname);
+            if(!handle)    return MyMessagePtr();
+            return handle->messages->Front();
         }
 
         void Clear()
         {
+            {
+                std::unique_lock<std::mutex> lock(_handle_mtx);
+                for(auto& it : *_handles.load())
+                    it.second->deleted.store(true, std::memory_order_release);
+                _handles.store(std::make_shared<const QueueHandleMap>());
+            }
             _mqmp->Clear();
             _mmp->Clear();
             _bmp->Clear();
             _emp->Clear();
+            _cmp->Clear();
         }
 
         bool ExistExchange(const std::string& ename)
@@ -158,5 +311,49 @@ namespace MyMQ
         {
             return _mqmp->Exists(qname);
         }
+
+    private:
+        // 队列的元数据、消息与消费者都已就绪后生成句柄；已存在则直接返回
+        QueueHandlePtr openHandle(const std::string& qname)
+        {
+            std::unique_lock<std::mutex> lock(_handle_mtx);
+            auto handles = _handles.load();
+            auto it = handles->find(qname);
+            if(it != handles->end())    return it->second;
+
+            auto meta = _mqmp->SelectQueue(qname);
+            auto sit = meta->args.find("x-consumer-strategy");
+            _cmp->InitQueueConsumer(qname, sit == meta->args.end() ? ConsumerStrategy::ROUND_ROBIN
+                                                                   : ParseConsumerStrategy(sit->second));
+            auto handle = std::make_shared<QueueHandle>(meta,
+                                                        _mmp->GetQueueMessage(qname),
+                                                        _cmp->GetQueueConsumer(qname));
+            auto next = std::make_shared<QueueHandleMap>(*handles);
+            next->insert(std::make_pair(qname, handle));
+            _handles.store(std::move(next));
+            return handle;
+        }
+
+        void closeHandle(const std::string& qname)
+        {
+            std::unique_lock<std::mutex> lock(_handle_mtx);
+            auto handles = _handles.load();
+            auto it = handles->find(qname);
+            if(it == handles->end())    return;
+
+            it->second->deleted.store(true, std::memory_order_release);
+            auto next = std::make_shared<QueueHandleMap>(*handles);
+            next->erase(qname);
+            _handles.store(std::move(next));
+        }
+
+    public:
+        static MetaStorePtr CreateMetaStore(MetaBackend backend, const std::string& dbfile)
+        {
+            if(backend == MetaBackend::JOURNAL)
+                return std::make_shared<JournalMetaStore>(dbfile);
+
+            return std::make_shared<SqliteMetaStore>(dbfile);
+        }
     };
 };
\ No newline at end of file
@@ -0,0 +1,433 @@
+#pragma once
+
+#include "exchange.hpp"
+#include "msgqueue.hpp"
+#include "binding.hpp"
+#include <map>
+#include <mutex>
+#include <zlib.h>   // crc32
+
+// 日志元数据后端
+// 每条记录: [uint32 长度][uint32 crc32][MetaRecord]，只追加；
+// 追加的记录数达到阈值后把当前状态写成快照，并截断日志。
+namespace MyMQ
+{
+    #define JOURNAL_SUBFIX ".journal"
+    #define SNAPSHOT_SUBFIX ".snapshot"
+
+    class JournalMetaStore : public MetaStore
+    {
+    private:
+        using BindingKey = std::pair<std::string, std::string>;
+
+        // 交换机、队列、绑定管理器各自持锁调用同一个存储，由这把锁串行化日志写入与内存状态
+        std::mutex _mutex;
+        std::string _logfile;
+        std::string _snapfile;
+        int _fd;
+        bool _broken = false;               // 写失败且无法截回原位置，拒绝后续写入
+
+        bool _in_tx;
+        std::vector<MetaRecord> _pending;   // 事务中尚未提交的记录
+        size_t _appended;                   // 上次快照后追加的记录数
+        size_t _snapshot_interval;
+
+        // 当前元数据，恢复与生成快照都基于它
+        std::map<std::string, MetaRecord> _exchanges;
+        std::map<std::string, MetaRecord> _queues;
+        std::map<BindingKey, MetaRecord> _bindings;
+
+    public:
+        explicit JournalMetaStore(const std::string& dbfile, size_t snapshot_interval = 1024)
+        :_fd(-1), _in_tx(false), _appended(0), _snapshot_interval(snapshot_interval)
+        {
+            std::string base = dbfile;
+            size_t dot = base.find_last_of('.');
+            size_t slash = base.find_last_of('/');
+            if(dot != std::string::npos && (slash == std::string::npos || dot > slash))
+                base.erase(dot);
+            _logfile = base + JOURNAL_SUBFIX;
+            _snapfile = base + SNAPSHOT_SUBFIX;
+
+            FileHelper::CreateDirectory(FileHelper::ParentDirectory(dbfile));
+            replay(_snapfile, false);
+            size_t valid = replay(_logfile, true);
+
+            _fd = ::open(_logfile.c_str(), O_WRONLY | O_CREAT, 0664);
+            if(_fd < 0)
+            {
+                LOG_CRITICAL("元数据日志 {} 打开失败: {}", _logfile, strerror(errno));
+                abort();
+            }
+            // 丢弃末尾写了一半的记录
+            if(valid < FileHelper(_logfile).Size())
+            {
+                LOG_WARN("元数据日志 {} 尾部损坏，截断至 {} 字节", _logfile, valid);
+                ::ftruncate(_fd, valid);
+            }
+            ::lseek(_fd, 0, SEEK_END);
+        }
+
+        ~JournalMetaStore() override
+        {
+            if(_fd >= 0) ::close(_fd);
+        }
+
+        bool Begin() override
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _in_tx = true;
+            return true;
+        }
+
+        bool Commit() override
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _in_tx = false;
+            std::vector<MetaRecord> records;
+            records.swap(_pending);
+            return write(records);
+        }
+
+        bool Rollback() override
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _in_tx = false;
+            _pending.clear();
+            return true;
+        }
+
+        bool InsertExchange(const ExchangePtr& exp) override
+        {
+            MetaRecord rec;
+            rec.set_op(PUT_EXCHANGE);
+            rec.set_exchange_name(exp->name);
+            rec.set_exchange_type(exp->type);
+            rec.set_durable(exp->durable);
+            rec.set_auto_delete(exp->auto_delete);
+            *rec.mutable_args() = exp->args;
+            return append(rec);
+        }
+
+        void RemoveExchange(const std::string& name) override
+        {
+            MetaRecord rec;
+            rec.set_op(DEL_EXCHANGE);
+            rec.set_exchange_name(name);
+            append(rec);
+        }
+
+        ExchangeMap RecoveryExchanges() override
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            ExchangeMap result;
+            for(auto& it : _exchanges)
+            {
+                auto& rec = it.second;
+                auto exp = std::make_shared<Exchange>(rec.exchange_name(), rec.exchange_type(),
+                                                      rec.durable(), rec.auto_delete(), rec.args());
+                result.insert(std::make_pair(exp->name, exp));
+            }
+            return result;
+        }
+
+        void ClearExchanges() override
+        {
+            MetaRecord rec;
+            rec.set_op(CLEAR_EXCHANGES);
+            append(rec);
+        }
+
+        bool InsertQueue(const MsgQueuePtr& mqp) override
+        {
+            MetaRecord rec;
+            rec.set_op(PUT_QUEUE);
+            rec.set_queue_name(mqp->name);
+            rec.set_durable(mqp->durable);
+            rec.set_exclusive(mqp->exclusive);
+            rec.set_auto_delete(mqp->auto_delete);
+            *rec.mutable_args() = mqp->args;
+            return append(rec);
+        }
+
+        void RemoveQueue(const std::string& name) override
+        {
+            MetaRecord rec;
+            rec.set_op(DEL_QUEUE);
+            rec.set_queue_name(name);
+            append(rec);
+        }
+
+        QueueMap RecoveryQueues() override
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            QueueMap result;
+            for(auto& it : _queues)
+            {
+                auto& rec = it.second;
+                auto mqp = std::make_shared<MsgQueue>(rec.queue_name(), rec.durable(), rec.exclusive(),
+                                                      rec.auto_delete(), rec.args());
+                result.insert(std::make_pair(mqp->name, mqp));
+            }
+            return result;
+        }
+
+        void ClearQueues() override
+        {
+            MetaRecord rec;
+            rec.set_op(CLEAR_QUEUES);
+            append(rec);
+        }
+
+        bool InsertBinding(const BindingPtr& bp) override
+        {
+            MetaRecord rec;
+            rec.set_op(PUT_BINDING);
+            rec.set_exchange_name(bp->exchange_name);
+            rec.set_queue_name(bp->msgqueue_name);
+            rec.set_binding_key(bp->binding_key);
+            *rec.mutable_binding_args() = bp->args;
+            return append(rec);
+        }
+
+        void RemoveBinding(const std::string& ename, const std::string& qname) override
+        {
+            MetaRecord rec;
+            rec.set_op(DEL_BINDING);
+            rec.set_exchange_name(ename);
+            rec.set_queue_name(qname);
+            append(rec);
+        }
+
+        void RemoveExchangeBindings(const std::string& ename) override
+        {
+            MetaRecord rec;
+            rec.set_op(DEL_EXCHANGE_BINDINGS);
+            rec.set_exchange_name(ename);
+            append(rec);
+        }
+
+        void RemoveMsgQueueBindings(const std::string& qname) override
+        {
+            MetaRecord rec;
+            rec.set_op(DEL_QUEUE_BINDINGS);
+            rec.set_queue_name(qname);
+            append(rec);
+        }
+
+        BindingMap RecoveryBindings() override
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            BindingMap result;
+            for(auto& it : _bindings)
+            {
+                auto& rec = it.second;
+                auto bp = std::make_shared<Binding>(rec.exchange_name(), rec.queue_name(), rec.binding_key(),
+                                                   rec.binding_args());
+                result[bp->exchange_name].insert(std::make_pair(bp->msgqueue_name, bp));
+            }
+            return result;
+        }
+
+        void ClearBindings() override
+        {
+            MetaRecord rec;
+            rec.set_op(CLEAR_BINDINGS);
+            append(rec);
+        }
+
+    private:
+        bool append(const MetaRecord& rec)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            if(_in_tx)
+            {
+                _pending.push_back(rec);
+                return true;
+            }
+            return write({rec});
+        }
+
+        // 一次 write + fdatasync 落盘一组记录，成功后才更新内存状态。
+        // 失败时把日志截回写入前的长度，避免残缺的记录挡住之后追加的记录
+        bool write(const std::vector<MetaRecord>& records)
+        {
+            if(records.empty())    return true;
+            if(_broken)
+            {
+                LOG_ERROR("元数据日志 {} 已损坏，拒绝写入", _logfile);
+                return false;
+            }
+
+            std::string buf;
+            for(auto& rec : records)   frame(buf, rec);
+
+            off_t start = ::lseek(_fd, 0, SEEK_CUR);
+            if(start < 0 || !writeAll(_fd, buf) || ::fdatasync(_fd) != 0)
+            {
+                LOG_ERROR("元数据日志 {} 写入失败: {}", _logfile, strerror(errno));
+                if(start < 0 || ::ftruncate(_fd, start) != 0 || ::lseek(_fd, start, SEEK_SET) != start)
+                {
+                    LOG_CRITICAL("元数据日志 {} 无法回退到 {} 字节: {}", _logfile, start, strerror(errno));
+                    _broken = true;
+                }
+                return false;
+            }
+
+            for(auto& rec : records)   apply(rec);
+            _appended += records.size();
+            if(_appended >= _snapshot_interval)
+                snapshot();
+            return true;
+        }
+
+        // 当前状态写入临时文件后原子替换快照，再清空日志
+        void snapshot()
+        {
+            std::string buf;
+            for(auto& it : _exchanges) frame(buf, it.second);
+            for(auto& it : _queues)    frame(buf, it.second);
+            for(auto& it : _bindings)  frame(buf, it.second);
+
+            std::string tmpfile = _snapfile + ".tmp";
+            int fd = ::open(tmpfile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0664);
+            if(fd < 0)
+            {
+                LOG_ERROR("快照文件 {} 创建失败: {}", tmpfile, strerror(errno));
+                return;
+            }
+            bool ok = writeAll(fd, buf) && ::fsync(fd) == 0;
+            ::close(fd);
+            if(!ok || ::rename(tmpfile.c_str(), _snapfile.c_str()) != 0)
+            {
+                LOG_ERROR("快照文件 {} 写入失败", _snapfile);
+                return;
+            }
+
+            // rename 要在目录落盘后才持久，否则清空日志后崩溃可能既没有新快照也没有日志
+            int dirfd = ::open(FileHelper::ParentDirectory(_snapfile).c_str(), O_RDONLY | O_DIRECTORY);
+            ok = dirfd >= 0 && ::fsync(dirfd) == 0;
+            if(dirfd >= 0)  ::close(dirfd);
+            if(!ok)
+            {
+                LOG_ERROR("快照目录同步失败，保留日志: {}", strerror(errno));
+                return;
+            }
+
+            // 快照已包含日志中的全部修改；即使截断前崩溃，重放旧日志也是幂等的
+            if(::ftruncate(_fd, 0) != 0)
+            {
+                LOG_ERROR("元数据日志 {} 截断失败，保留日志: {}", _logfile, strerror(errno));
+                return;
+            }
+            ::lseek(_fd, 0, SEEK_SET);
+            _appended = 0;
+        }
+
+        // 重放文件中的记录，返回最后一条完整记录的结尾偏移
+        size_t replay(const std::string& file, bool count)
+        {
+            FileHelper helper(file);
+            if(!helper.Exists())   return 0;
+
+            std::string data(helper.Size(), '\0');
+            if(!data.empty() && !helper.Read(data.data(), 0, data.size()))
+                return 0;
+
+            size_t offset = 0;
+            while(offset + 2 * sizeof(uint32_t) <= data.size())
+            {
+                uint32_t len, crc;
+                memcpy(&len, data.data() + offset, sizeof(len));
+                memcpy(&crc, data.data() + offset + sizeof(len), sizeof(crc));
+                const char* body = data.data() + offset + 2 * sizeof(uint32_t);
+                if(offset + 2 * sizeof(uint32_t) + len > data.size())
+                    break;
+                if(crc != checksum(body, len))
+                    break;
+
+                MetaRecord rec;
+                if(!rec.ParseFromArray(body, len))
+                    break;
+                apply(rec);
+                if(count) ++_appended;
+                offset += 2 * sizeof(uint32_t) + len;
+            }
+            return offset;
+        }
+
+        void apply(const MetaRecord& rec)
+        {
+            switch(rec.op())
+            {
+            case PUT_EXCHANGE:
+                _exchanges[rec.exchange_name()] = rec;
+                break;
+            case DEL_EXCHANGE:
+                _exchanges.erase(rec.exchange_name());
+                break;
+            case CLEAR_EXCHANGES:
+                _exchanges.clear();
+                break;
+            case PUT_QUEUE:
+                _queues[rec.queue_name()] = rec;
+                break;
+            case DEL_QUEUE:
+                _queues.erase(rec.queue_name());
+                break;
+            case CLEAR_QUEUES:
+                _queues.clear();
+                break;
+            case PUT_BINDING:
+                _bindings[BindingKey(rec.exchange_name(), rec.queue_name())] = rec;
+                break;
+            case DEL_BINDING:
+                _bindings.erase(BindingKey(rec.exchange_name(), rec.queue_name()));
+                break;
+            case DEL_EXCHANGE_BINDINGS:
+                std::erase_if(_bindings, [&rec](auto& it) { return it.first.first == rec.exchange_name(); });
+                break;
+            case DEL_QUEUE_BINDINGS:
+                std::erase_if(_bindings, [&rec](auto& it) { return it.first.second == rec.queue_name(); });
+                break;
+            case CLEAR_BINDINGS:
+                _bindings.clear();
+                break;
+            default:
+                LOG_WARN("未知的元数据日志记录：{}", (int)rec.op());
+                break;
+            }
+        }
+
+        static void frame(std::string& buf, const MetaRecord& rec)
+        {
+            std::string body = rec.SerializeAsString();
+            uint32_t len = body.size();
+            uint32_t crc = checksum(body.data(), body.size());
+            buf.append((const char*)&len, sizeof(len));
+            buf.append((const char*)&crc, sizeof(crc));
+            buf.append(body);
+        }
+
+        static uint32_t checksum(const char* data, size_t len)
+        {
+            return ::crc32(0, reinterpret_cast<const Bytef*>(data), len);
+        }
+
+        static bool writeAll(int fd, const std::string& buf)
+        {
+            size_t written = 0;
+            while(written < buf.size())
+            {
+                ssize_t n = ::write(fd, buf.data() + written, buf.size() - written);
+                if(n < 0)
+                {
+                    if(errno == EINTR) continue;
+                    return false;
+                }
+                written += n;
+            }
+            return true;
+        }
+    };
+}
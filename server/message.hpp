@@ -1,5 +1,6 @@
 #pragma once
 #include "help.hpp"
+#include "flow.hpp"
 #include "msg.pb.h"
 
 
@@ -17,6 +18,8 @@ namespace MyMQ {
     using MyMessagePtr = std::shared_ptr<Message>;
     using MessageManagerPtr = std::shared_ptr<MessageManager>;
     using MessageMapperPtr = std::shared_ptr<MessageMapper>;
+    using MessageRef = std::pair<const BasicProperties*, const std::string*>;   // 批量插入的 (属性, 消息体)
+    using QueuedMessage = std::pair<MyMessagePtr, MessageId>;   // 待投递的消息与其二进制 ID
 
     class MessageMapper
     {
@@ -83,6 +86,55 @@ namespace MyMQ {
             return true;
         }
 
+        // 批量追加，整批拼成一块一次写入
+        bool Insert(std::vector<MyMessagePtr>& msgs)
+        {
+            FileHelper helper(_datafile);
+            size_t offset = helper.Size();
+            std::string buffer;
+            for(auto& msg : msgs)
+            {
+                std::string body = msg->payload().SerializeAsString();
+                size_t msg_size = body.size();
+                buffer.append((const char*)&msg_size, sizeof(size_t));
+                msg->set_offset(offset + buffer.size());
+                msg->set_length(body.size());
+                buffer.append(body);
+            }
+            if(helper.Write(buffer.data(), offset, buffer.size()) == false)
+            {
+                LOG_DEBUG("写入失败");
+                return false;
+            }
+            return true;
+        }
+
+        // 批量写入删除标志，整批只打开一次数据文件
+        bool Remove(std::vector<MyMessagePtr>& msgs)
+        {
+            std::vector<std::pair<size_t, std::string>> chunks;
+            chunks.reserve(msgs.size());
+            for(auto& msg : msgs)
+            {
+                msg->mutable_payload()->set_valid("0");
+                std::string body = msg->payload().SerializeAsString();
+                if(body.size() != msg->length())
+                {
+                    LOG_DEBUG("文件长度与原数据长度不一致");
+                    return false;
+                }
+                chunks.emplace_back(msg->offset(), std::move(body));
+            }
+            if(chunks.empty())  return true;
+
+            if(FileHelper(_datafile).Write(chunks) == false)
+            {
+                LOG_DEBUG("队列写入数据失败");
+                return false;
+            }
+            return true;
+        }
+
         // 读取有效数据并存入tmp文件，删除datafil
         std::list<MyMessagePtr> Gc()
         {
@@ -188,9 +240,9 @@ namespace MyMQ {
     class QueueMessage
     {
     private:
-        std::list<MyMessagePtr> _msgs;    //TODO boost：lookfree?
-        std::unordered_map<std::string, MyMessagePtr> _durableMsgs;
-        std::unordered_map<std::string, MyMessagePtr> _waitackMsgs;
+        std::list<QueuedMessage> _msgs;    //TODO boost：lookfree?
+        std::unordered_map<MessageId, MyMessagePtr, MessageIdHash> _durableMsgs;
+        std::unordered_map<MessageId, MyMessagePtr, MessageIdHash> _waitackMsgs;
         MessageMapper _mapper;
 
         std::mutex _mutex{};
@@ -198,38 +250,28 @@ namespace MyMQ {
 
         size_t _total_count;    
         size_t _valid_count;
+
+        FlowControlPtr _flow;   // 为空时不做内存统计
+        size_t _bytes = 0;      // 内存中消息（待投递与待确认）的消息体字节数
+        bool _over = false;     // 已触发队列水位告警
         
         #define LOCK(mtx) std::unique_lock<std::mutex> lock(mtx)
 
 
     public:
-        QueueMessage(std::string& basedir, const std::string& qname)
-        :_mapper(basedir, qname), _qname(qname), _total_count(0), _valid_count(0)
+        QueueMessage(std::string& basedir, const std::string& qname, const FlowControlPtr& flow = nullptr)
+        :_mapper(basedir, qname), _qname(qname), _total_count(0), _valid_count(0), _flow(flow)
         {
             // Recovery();
         }
 
         bool Insert(const BasicProperties* properties, const std::string& body, bool delivery_mode = true)
         {
-            // 构建Msg
-            MyMessagePtr msg = std::make_shared<Message>();
-            auto payload = msg->mutable_payload();
-            payload->set_body(body);
-            if(properties != nullptr)
-            {
-                payload->mutable_properties()->set_id(properties->id());
-                payload->mutable_properties()->set_delivery_mode(properties->delivery_mode());
-                payload->mutable_properties()->set_routing_key(properties->routing_key());
-            }
-            else
-            {
-                auto mode = delivery_mode ? DeliveryMode::DURABLE : DeliveryMode::UNDURABLE;
-                payload->mutable_properties()->set_id(UUIDHelper::UUID());
-                payload->mutable_properties()->set_delivery_mode(mode);
-            }
+            MessageId id;
+            MyMessagePtr msg = build(properties, body, delivery_mode, id);
             // 判断持久化
             LOCK(_mutex);
-            if(payload->properties().delivery_mode() == DeliveryMode::DURABLE)
+            if(msg->payload().properties().delivery_mode() == DeliveryMode::DURABLE)
             {
                 msg->mutable_payload()->set_valid("1");
                 bool ret = _mapper.Insert(msg);
@@ -240,25 +282,93 @@ namespace MyMQ {
                 }
                 ++_valid_count;
                 ++_total_count;
-                _durableMsgs.insert(std::make_pair(payload->properties().id(), msg));
+                _durableMsgs.insert(std::make_pair(id, msg));
             }
             // 加载至内存
-            _msgs.push_back(msg);
+            _msgs.emplace_back(msg, id);
+            charge(body.size());
             return true;
         }
 
-        MyMessagePtr Front()
+        // 直通投递：待投递队列为空时，把非持久化消息直接登记为待确认，不进入待投递队列；
+        // 队列不为空或消息需要持久化时不插入，返回空
+        MyMessagePtr InsertUnacked(const BasicProperties* properties, const std::string& body, MessageId& id)
+        {
+            MyMessagePtr msg = build(properties, body, false, id);
+            if(msg->payload().properties().delivery_mode() == DeliveryMode::DURABLE)
+                return MyMessagePtr();
+            LOCK(_mutex);
+            if(!_msgs.empty())  return MyMessagePtr();
+            _waitackMsgs.insert(std::make_pair(id, msg));
+            charge(body.size());
+            return msg;
+        }
+
+        // 批量插入：整批只加锁一次，持久化消息一次写入数据文件；返回插入的条数
+        size_t Insert(const std::vector<MessageRef>& batch, bool delivery_mode = true)
+        {
+            std::vector<MyMessagePtr> msgs, durable;
+            std::vector<MessageId> ids;
+            msgs.reserve(batch.size());
+            ids.reserve(batch.size());
+            for(auto& ref : batch)
+            {
+                MessageId id;
+                auto msg = build(ref.first, *ref.second, delivery_mode, id);
+                if(msg->payload().properties().delivery_mode() == DeliveryMode::DURABLE)
+                {
+                    msg->mutable_payload()->set_valid("1");
+                    durable.push_back(msg);
+                }
+                msgs.push_back(std::move(msg));
+                ids.push_back(id);
+            }
+
+            LOCK(_mutex);
+            if(!durable.empty())
+            {
+                if(!_mapper.Insert(durable))
+                {
+                    LOG_DEBUG("持久化存储 {} 条信息失败", durable.size());
+                    return 0;
+                }
+                _valid_count += durable.size();
+                _total_count += durable.size();
+            }
+            size_t bytes = 0;
+            for(size_t i = 0; i < msgs.size(); ++i)
+            {
+                if(msgs[i]->payload().properties().delivery_mode() == DeliveryMode::DURABLE)
+                    _durableMsgs.insert(std::make_pair(ids[i], msgs[i]));
+                _msgs.emplace_back(msgs[i], ids[i]);
+                bytes += msgs[i]->payload().body().size();
+            }
+            charge(bytes);
+            return msgs.size();
+        }
+
+        // id 非空时顺带返回消息 ID，供投递窗口记录；为空时调用者按字符串 ID 确认，此时才补上字符串形式
+        MyMessagePtr Front(MessageId* id = nullptr)
         {
             LOCK(_mutex);
-            auto font = _msgs.front();
+            if(_msgs.empty())   return MyMessagePtr();
+            auto [font, msg_id] = std::move(_msgs.front());
             _msgs.pop_front();
-            _waitackMsgs.insert(std::make_pair(font->payload().properties().id(), font));
+            _waitackMsgs.insert(std::make_pair(msg_id, font));
+            if(id)  *id = msg_id;
+            else if(font->payload().properties().id().empty())
+                font->mutable_payload()->mutable_properties()->set_id(msg_id.ToString());
 
             return font;
             // return std::move(font);  c++17后自动优化?
         }
 
         bool Remove(const std::string& msg_id)
+        {
+            return Remove(MessageId::FromString(msg_id));
+        }
+
+        bool Remove(const MessageId& msg_id)
         {
             // LOCK(_mutex);
             std::unique_lock<std::mutex> lock(_mutex);
@@ -280,10 +390,62 @@ namespace MyMQ {
             }
 
             //内存删除
+            discharge(payload.body().size());
             _waitackMsgs.erase(it);
             return true;
         }
 
+        // 批量确认：整批只加锁一次，持久化消息的删除标志一次写入；返回确认的条数
+        size_t Remove(const std::vector<MessageId>& ids)
+        {
+            LOCK(_mutex);
+            size_t n = 0, bytes = 0;
+            std::vector<MyMessagePtr> durable;
+            for(auto& id : ids)
+            {
+                auto it = _waitackMsgs.find(id);
+                if(it == _waitackMsgs.end())
+                {
+                    LOG_DEBUG("等待队列寻找信息失败：");
+                    continue;
+                }
+                if(it->second->payload().properties().delivery_mode() == DeliveryMode::DURABLE)
+                {
+                    durable.push_back(it->second);
+                    _durableMsgs.erase(id);
+                }
+                bytes += it->second->payload().body().size();
+                _waitackMsgs.erase(it);
+                ++n;
+            }
+            discharge(bytes);
+            if(!durable.empty())
+            {
+                _mapper.Remove(durable);
+                _valid_count -= durable.size();
+                Gc();
+            }
+            return n;
+        }
+
+        // 把待确认的消息按给定顺序整体放回待投递队列头部，返回放回的条数；
+        // 只查找给定的 ID，不扫描队列。消息仍在内存中，字节统计不变
+        size_t Requeue(const std::vector<MessageId>& ids)
+        {
+            LOCK(_mutex);
+            std::list<QueuedMessage> msgs;
+            for(auto& id : ids)
+            {
+                auto it = _waitackMsgs.find(id);
+                if(it == _waitackMsgs.end())    continue;
+                msgs.emplace_back(std::move(it->second), id);
+                _waitackMsgs.erase(it);
+            }
+            size_t n = msgs.size();
+            _msgs.splice(_msgs.begin(), msgs);
+            return n;
+        }
+
         size_t GetTableCount()
         {
             LOCK(_mutex);
@@ -322,6 +484,13 @@ namespace MyMQ {
             _durableMsgs.clear();
             _msgs.clear();
             _valid_count = _total_count = 0;
+            discharge(_bytes);
+        }
+
+        size_t GetBytes()
+        {
+            LOCK(_mutex);
+            return _bytes;
         }
 
         bool Recovery()
@@ -329,7 +498,7 @@ namespace MyMQ {
             auto msgs = _mapper.Gc();
             for(auto& it : msgs)
             {
-                _durableMsgs.insert(std::make_pair(it->payload().properties().id(), it));
+                _durableMsgs.insert(std::make_pair(MessageId::FromString(it->payload().properties().id()), it));
             }
             _valid_count = _total_count = msgs.size();
             return true;
@@ -337,6 +506,59 @@ namespace MyMQ {
 
     
     private:
+        // 以下在持有 _mutex 时调用：更新内存统计，队列超过水位时告警，回落到水位的 3/4 以下解除。
+        // 告警是全局的，会阻塞所有发布者连接，而不只是向本队列发布的连接
+        void charge(size_t bytes)
+        {
+            _bytes += bytes;
+            if(!_flow)  return;
+            _flow->Add(bytes);
+            size_t high = _flow->QueueHigh();
+            if(high && !_over && _bytes >= high)
+            {
+                _over = true;
+                _flow->Alarm("queue:" + _qname, true);
+            }
+        }
+
+        void discharge(size_t bytes)
+        {
+            _bytes -= bytes;
+            if(!_flow)  return;
+            _flow->Sub(bytes);
+            if(_over && _bytes <= _flow->QueueHigh() / 4 * 3)
+            {
+                _over = false;
+                _flow->Alarm("queue:" + _qname, false);
+            }
+        }
+
+        static MyMessagePtr build(const BasicProperties* properties, const std::string& body, bool delivery_mode, MessageId& id)
+        {
+            MyMessagePtr msg = std::make_shared<Message>();
+            auto payload = msg->mutable_payload();
+            payload->set_body(body);
+            if(properties != nullptr)
+            {
+                id = MessageId::FromString(properties->id());
+                payload->mutable_properties()->set_id(properties->id());
+                payload->mutable_properties()->set_delivery_mode(properties->delivery_mode());
+                payload->mutable_properties()->set_routing_key(properties->routing_key());
+                *payload->mutable_properties()->mutable_headers() = properties->headers();
+            }
+            else
+            {
+                // 进程内只用二进制 ID；持久化消息要写入数据文件供恢复，才格式化成字符串，
+                // 其余的在发给客户端时再格式化
+                auto mode = delivery_mode ? DeliveryMode::DURABLE : DeliveryMode::UNDURABLE;
+                id = MessageId::Generate();
+                if(mode == DeliveryMode::DURABLE)
+                    payload->mutable_properties()->set_id(id.ToString());
+                payload->mutable_properties()->set_delivery_mode(mode);
+            }
+            return msg;
+        }
+
         bool GCCheck()
         {
             if(_total_count > 2000 && _valid_count * 10 / _total_count < 5)
@@ -352,12 +574,13 @@ namespace MyMQ {
             
             for(auto& msg : msgs)
             {
-                auto it = _durableMsgs.find(msg->payload().properties().id());
+                auto id = MessageId::FromString(msg->payload().properties().id());
+                auto it = _durableMsgs.find(id);
                 if(it == _durableMsgs.end())
                 {
                     LOG_DEBUG("垃圾回收逻辑错误");
-                    _msgs.push_back(msg);
-                    _durableMsgs.insert(std::make_pair(msg->payload().properties().id(), msg));
+                    _msgs.emplace_back(msg, id);
+                    _durableMsgs.insert(std::make_pair(id, msg));
                     continue;
                 }
 
@@ -378,6 +601,7 @@ namespace MyMQ {
         std::mutex _mutex;
         std::string _basedir;
         std::unordered_map<std::string, QueueMessagePtr> _queMsgs;
+        FlowControlPtr _flow;
         
         #define LOCK(mtx) std::unique_lock<std::mutex> lock(mtx)
 
@@ -396,8 +620,8 @@ namespace MyMQ {
         }
 
     public:
-        explicit MessageManager(const std::string& basedir)
-        :_basedir(basedir)
+        explicit MessageManager(const std::string& basedir, const FlowControlPtr& flow = nullptr)
+        :_basedir(basedir), _flow(flow)
         {}
 
         void InitQueueManager(const std::string& qname)
@@ -407,7 +631,7 @@ namespace MyMQ {
                 LOCK(_mutex);
                 auto it = _queMsgs.find(qname);
                 if(it != _queMsgs.end())    return;
-                qmp = std::make_shared<QueueMessage>(_basedir, qname);
+                qmp = std::make_shared<QueueMessage>(_basedir, qname, _flow);
                 _queMsgs.insert(std::make_pair(qname, qmp));
             }
 
@@ -439,6 +663,14 @@ namespace MyMQ {
             return qmp->Insert(properties, body, delivermode);
         }
 
+        QueueMessagePtr GetQueueMessage(const std::string& qname)
+        {
+            LOCK(_mutex);
+            QueueMessagePtr qmp;
+            findQueue(qname, qmp);
+            return qmp;
+        }
+
         MyMessagePtr Front(const std::string& qname)
         {
             QueueMessagePtr qmp;
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "help.hpp"
+
+// 元数据存储接口：交换机、队列、绑定的持久化后端
+namespace MyMQ
+{
+    struct Exchange;
+    struct MsgQueue;
+    struct Binding;
+    class MetaStore;
+
+    using ExchangePtr = std::shared_ptr<Exchange>;
+    using ExchangeMap = std::unordered_map<std::string, ExchangePtr>;
+    using MsgQueuePtr = std::shared_ptr<MsgQueue>;
+    using QueueMap = std::unordered_map<std::string, MsgQueuePtr>;
+    using BindingPtr = std::shared_ptr<Binding>;    //交换机指针
+    using MsgQueueBindingMap = std::unordered_map<std::string, BindingPtr>; //交换机队列指针
+    using BindingMap = std::unordered_map<std::string, MsgQueueBindingMap>; //
+    using MetaStorePtr = std::shared_ptr<MetaStore>;
+
+    enum class MetaBackend
+    {
+        SQLITE,     // meta.db，三张数据表
+        JOURNAL     // 追加写、带校验的日志 + 定期快照
+    };
+
+    class MetaStore
+    {
+    public:
+        virtual ~MetaStore() = default;
+
+        // 事务：Begin 之后的写操作在 Commit 时一并落盘，Rollback 全部丢弃
+        virtual bool Begin() = 0;
+        virtual bool Commit() = 0;
+        virtual bool Rollback() = 0;
+
+        virtual bool InsertExchange(const ExchangePtr& exp) = 0;
+        virtual void RemoveExchange(const std::string& name) = 0;
+        virtual ExchangeMap RecoveryExchanges() = 0;
+        virtual void ClearExchanges() = 0;
+
+        virtual bool InsertQueue(const MsgQueuePtr& mqp) = 0;
+        virtual void RemoveQueue(const std::string& name) = 0;
+        virtual QueueMap RecoveryQueues() = 0;
+        virtual void ClearQueues() = 0;
+
+        virtual bool InsertBinding(const BindingPtr& bp) = 0;
+        virtual void RemoveBinding(const std::string& ename, const std::string& qname) = 0;
+        virtual void RemoveExchangeBindings(const std::string& ename) = 0;
+        virtual void RemoveMsgQueueBindings(const std::string& qname) = 0;
+        virtual BindingMap RecoveryBindings() = 0;
+        virtual void ClearBindings() = 0;
+    };
+}
@@ -1,16 +1,14 @@
 #pragma once
 
-#include "help.hpp"
+#include "metastore.hpp"
+#include <atomic>
 
 // 队列数据管理模块
 namespace MyMQ
 {
-    struct MsgQueue;
     class MsgQueueManager;
 
     using MsgQueueManagerPtr = std::shared_ptr<MsgQueueManager>;
-    using MsgQueuePtr = std::shared_ptr<MsgQueue>;
-    using QueueMap = std::unordered_map<std::string, MsgQueuePtr>;
 
     struct MsgQueue 
     {
@@ -62,16 +60,13 @@ namespace MyMQ
     class MsgQueueMapper
     {
     private:
-        SqliteHelper _sql_helper;
+        SqliteHelperPtr _sql_helper;
     public:
         ~MsgQueueMapper() = default;
 
-        MsgQueueMapper(const std::string& dbfile)
-        :_sql_helper(dbfile)
+        explicit MsgQueueMapper(const SqliteHelperPtr& helper)
+        :_sql_helper(helper)
         {
-            std::string path = FileHelper::ParentDirectory(dbfile);
-            FileHelper::CreateDirectory(path);
-            _sql_helper.Open();
             CreateTable();
         }
 
@@ -84,17 +79,17 @@ namespace MyMQ
             sql << "exclusive int, ";
             sql << "auto_delete int, ";
             sql << "args varchar(128));";
-            assert(_sql_helper.Exec(sql.str(), nullptr, nullptr));
+            assert(_sql_helper->Exec(sql.str(), nullptr, nullptr));
         }
 
         void RemoveTable()
         {
             std::stringstream sql;
             sql << "drop table if exists queue_table;";
-            _sql_helper.Exec(sql.str(), nullptr, nullptr);
+            _sql_helper->Exec(sql.str(), nullptr, nullptr);
         }
 
-        bool Insert(MsgQueuePtr& queue)
+        bool Insert(const MsgQueuePtr& queue)
         {
             std::stringstream sql;
             sql << "insert into queue_table values(";
@@ -103,7 +98,7 @@ namespace MyMQ
             sql << queue->exclusive << ", ";
             sql << queue->auto_delete << ", ";
             sql << "'" << queue->GetArgs() << "');";
-            return _sql_helper.Exec(sql.str(), nullptr, nullptr);
+            return _sql_helper->Exec(sql.str(), nullptr, nullptr);
         }
 
         void Remove(const std::string& name)
@@ -111,14 +106,14 @@ namespace MyMQ
             std::stringstream sql;
             sql << "delete from queue_table where name=";
             sql << "'" << name << "';";
-            _sql_helper.Exec(sql.str(), nullptr, nullptr);
+            _sql_helper->Exec(sql.str(), nullptr, nullptr);
         }
 
         QueueMap Recovery()
         {
             QueueMap result;
             std::string sql = "select name, durable, exclusive, auto_delete, args from queue_table;";
-            assert(_sql_helper.Exec(sql, selectCallback, &result));
+            assert(_sql_helper->Exec(sql, selectCallback, &result));
             return result;
         }
 
@@ -139,16 +134,17 @@ namespace MyMQ
     };
     
 
+    // 与 ExchangeManager 相同：写时复制快照，SelectQueue 无锁读取
     class MsgQueueManager
     {
     private:
         std::mutex _mutex;
-        MsgQueueMapper _mapper;
-        QueueMap _msg_queues;
+        MetaStorePtr _store;
+        std::atomic<std::shared_ptr<const QueueMap>> _msg_queues;
     public:
-        MsgQueueManager(const std::string &dbfile):_mapper(dbfile) 
+        explicit MsgQueueManager(const MetaStorePtr& store):_store(store)
         {
-            _msg_queues = _mapper.Recovery();
+            _msg_queues.store(std::make_shared<const QueueMap>(_store->RecoveryQueues()));
         }
 
         bool DeclareQueue(const std::string &qname, 
@@ -157,8 +153,8 @@ namespace MyMQ
             bool qauto_delete,
             const google::protobuf::Map<std::string, std::string> &qargs) {
             std::unique_lock<std::mutex> lock(_mutex);
-            auto it = _msg_queues.find(qname);
-            if (it != _msg_queues.end()) {
+            auto snap = _msg_queues.load();
+            if (snap->contains(qname)) {
                 return true;
             }
             MsgQueuePtr mqp = std::make_shared<MsgQueue>();
@@ -169,28 +165,34 @@ namespace MyMQ
             mqp->args = qargs;
             if (qdurable == true) 
             {
-                bool ret = _mapper.Insert(mqp);
+                bool ret = _store->InsertQueue(mqp);
                 if (ret == false) return false;
             }
-            _msg_queues.insert(std::make_pair(qname, mqp));
+            auto next = std::make_shared<QueueMap>(*snap);
+            next->insert(std::make_pair(qname, mqp));
+            _msg_queues.store(std::move(next));
             return true;
         } 
 
-        void DeleteQueue(const std::string &name) {
+        // persist 为 false 时只删除内存中的队列，用于事务回滚后撤销内存状态
+        void DeleteQueue(const std::string &name, bool persist = true) {
             std::unique_lock<std::mutex> lock(_mutex);
-            auto it = _msg_queues.find(name);
-            if (it == _msg_queues.end()) {
+            auto snap = _msg_queues.load();
+            auto it = snap->find(name);
+            if (it == snap->end()) {
                 return ;
             }
-            if (it->second->durable == true) _mapper.Remove(name);
-            _msg_queues.erase(name);
+            if (persist && it->second->durable == true) _store->RemoveQueue(name);
+            auto next = std::make_shared<QueueMap>(*snap);
+            next->erase(name);
+            _msg_queues.store(std::move(next));
         }
 
         MsgQueuePtr SelectQueue(const std::string &name) 
         {
-            std::unique_lock<std::mutex> lock(_mutex);
-            auto it = _msg_queues.find(name);
-            if (it == _msg_queues.end()) 
+            auto snap = _msg_queues.load();
+            auto it = snap->find(name);
+            if (it == snap->end()) 
             {
                 return MsgQueuePtr();
             }
@@ -198,33 +200,24 @@ namespace MyMQ
         }
 
         QueueMap AllQueues() {
-            std::unique_lock<std::mutex> lock(_mutex);
-            return _msg_queues;
+            return *_msg_queues.load();
         }
 
         bool Exists(const std::string &name) 
         {
-            std::unique_lock<std::mutex> lock(_mutex);
-            auto it = _msg_queues.find(name);
-            if (it == _msg_queues.end()) 
-            {
-                return false;
-            }
-            return true;
+            return _msg_queues.load()->contains(name);
         }
 
         size_t Size()
         {
-            std::unique_lock<std::mutex> lock(_mutex);
-            return _msg_queues.size();
+            return _msg_queues.load()->size();
         }
 
         void Clear() 
         {
             std::unique_lock<std::mutex> lock(_mutex);
-            _msg_queues.clear();
-            _mapper.RemoveTable();
+            _msg_queues.store(std::make_shared<const QueueMap>());
+            _store->ClearQueues();
         }
     };
 } // namespace rabbitMq
-
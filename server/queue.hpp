@@ -0,0 +1,48 @@
+#pragma once
+
+#include "msgqueue.hpp"
+#include "message.hpp"
+#include "consumer.hpp"
+#include "executor.hpp"
+#include <atomic>
+#include <deque>
+
+// 队列句柄：声明队列时解析一次，绑定持有它，
+// 发布与投递直接通过句柄访问队列，不再按队列名逐个查表
+namespace MyMQ
+{
+    struct QueueHandle;
+    struct GetWaiter;
+
+    using QueueHandlePtr = std::shared_ptr<QueueHandle>;
+    using GetWaiterPtr = std::shared_ptr<GetWaiter>;
+
+    // 在空队列上等待消息的拉取请求，只在队列的 strand 上取出与应答
+    struct GetWaiter
+    {
+        std::function<void(const QueueHandlePtr&)> serve;  // 取消息并应答
+        std::atomic<bool> done{false};  // 已应答或已超时，先置位者负责应答
+    };
+
+    struct QueueHandle
+    {
+        MsgQueuePtr meta;               // 队列属性
+        QueueMessagePtr messages;       // 队列消息
+        QueueConsumerPtr consumers;     // 队列消费者
+        std::atomic<bool> deleted{false};   // 队列已删除，旧的路由快照可能仍持有句柄
+        size_t hash;                    // 队列名的哈希，用于选择执行分片
+        StrandPtr strand = std::make_shared<Strand>();  // 本队列的投递串行执行
+        std::atomic<bool> drain_pending{false};         // 已有待执行的投递任务
+        std::deque<GetWaiterPtr> getters;               // 等待消息的拉取请求，只在 strand 上访问
+        std::atomic<size_t> handoff_pending{0};         // 已转到 strand 上、尚未完成的发布
+
+        QueueHandle(const MsgQueuePtr& qmeta, const QueueMessagePtr& qmessages, const QueueConsumerPtr& qconsumers)
+            :meta(qmeta), messages(qmessages), consumers(qconsumers), hash(std::hash<std::string>()(qmeta->name))
+        {}
+
+        const std::string& Name() const { return meta->name; }
+    };
+
+    using QueueHandleMap = std::unordered_map<std::string, QueueHandlePtr>;
+    using QueueHandleMapPtr = std::shared_ptr<const QueueHandleMap>;
+}
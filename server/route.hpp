@@ -5,12 +5,31 @@
 #pragma once
 
 #include "help.hpp"
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include <unordered_set>
 
 namespace MyMQ
 {
     class Router {
     public:
-        static bool IsLegalRoutingKey(const std::string &routingKey) {
+        // 一致性哈希交换机的绑定键是权重：空串为 1，否则须为正整数
+        static bool ParseWeight(std::string_view bindingKey, uint32_t& weight) {
+            if (bindingKey.empty()) {
+                weight = 1;
+                return true;
+            }
+            if (bindingKey.size() > 4) return false;
+            weight = 0;
+            for (auto ch: bindingKey) {
+                if (!std::isdigit(ch)) return false;
+                weight = weight * 10 + (ch - '0');
+            }
+            return weight > 0;
+        }
+
+        static bool IsLegalRoutingKey(std::string_view routingKey) {
             for (auto &it: routingKey) {
                 if (std::isalpha(it) ||
                     std::isdigit(it) ||
@@ -22,7 +41,7 @@ namespace MyMQ
             return true;
         }
 
-        static bool IsLegalBindingKey(const std::string &bindingKey) {
+        static bool IsLegalBindingKey(std::string_view bindingKey) {
             for (auto &ch: bindingKey) {
                 if (std::isdigit(ch) ||
                     std::isalpha(ch) ||
@@ -33,58 +52,461 @@ namespace MyMQ
                 return false;
             }
 
-            std::vector<std::string> sub;
-            StrHelper::Split(sub, bindingKey, ".");
+            KeyTokens sub;
+            StrHelper::Tokenize(sub, bindingKey, '.');
 
             for(auto& str : sub)
             {
-                if(str.size() > 1 && (str.find('*') != std::string::npos || str.find('#') != std::string::npos))
+                if(str.size() > 1 && (str.find('*') != std::string_view::npos || str.find('#') != std::string_view::npos))
                     return false;
             }
 
-            const static std::unordered_set<std::string> invalid = {"*#", "##", "#*"};
             // new.sport#.*.#
-            for (int i = 1; i < sub.size(); ++i) {
-                if (invalid.find(sub[i]) != invalid.end()) return false;
+            for (size_t i = 1; i < sub.size(); ++i) {
+                if (sub[i] == "*#" || sub[i] == "##" || sub[i] == "#*") return false;
             }
 
             return true;
         }
 
-        static bool Route(ExchangeType type, const std::string &routingKey, const std::string &bindingKey) {
+        static bool Route(ExchangeType type, std::string_view routingKey, std::string_view bindingKey) {
             if (type == ExchangeType::DIRECT)
                 return routingKey == bindingKey;
             else if (type == ExchangeType::FANOUT)   //广播
                 return true;
+            else if (type == ExchangeType::HEADERS ||           // 按消息头部匹配
+                     type == ExchangeType::CONSISTENT_HASH)     // 按哈希环只选一个队列
+                return false;
+
+            KeyTokens bkeys, rkeys;
+            StrHelper::Tokenize(bkeys, bindingKey, '.');
+            StrHelper::Tokenize(rkeys, routingKey, '.');
+
+            size_t n = bkeys.size();
+            size_t m = rkeys.size();
+
+            // dp[i][j] 只依赖第 i-1 行和本行，滚动两行即可
+            SmallVector<uint8_t, 32> prev, cur;
+            prev.assign(m + 1, false);
+            cur.assign(m + 1, false);
+            prev[0] = true;
+
+            for (size_t i = 1; i <= n; ++i) {
+                cur[0] = prev[0] && bkeys[i - 1] == "#";
+                for (size_t j = 1; j <= m; ++j) {
+                    if (bkeys[i - 1] == rkeys[j - 1] || bkeys[i - 1] == "*")
+                        cur[j] = prev[j - 1];
+                    else if (bkeys[i - 1] == "#")
+                        cur[j] = prev[j] | prev[j - 1] | cur[j - 1];
+                    else
+                        cur[j] = false;
+                }
+                std::swap(prev, cur);
+            }
+
+            return prev[m];
+        };
+    };
+
+    // 主题交换机的匹配树：按绑定键的单词逐层建树，'*'、'#' 各占一个独立分支。
+    // 节点不可变，插入/删除只复制根到目标节点的路径，旧树仍可被并发读取。
+    template<typename T>
+    class TopicTrie
+    {
+    public:
+        struct Node;
+        using NodePtr = std::shared_ptr<const Node>;
+
+        // 支持用 string_view 直接查找子节点
+        struct WordHash
+        {
+            using is_transparent = void;
+            size_t operator()(std::string_view word) const { return std::hash<std::string_view>{}(word); }
+        };
+
+        struct Node
+        {
+            std::unordered_map<std::string, NodePtr, WordHash, std::equal_to<>> children;
+            NodePtr star;               // '*'：恰好一个单词
+            NodePtr hash;               // '#'：零个或多个单词
+            std::vector<T> values;      // 绑定键在此结束的绑定
+        };
+
+        TopicTrie() = default;
+
+        TopicTrie Insert(const std::string& bindingKey, const T& value) const
+        {
+            KeyTokens words;
+            StrHelper::Tokenize(words, bindingKey, '.');
+            return TopicTrie(insert(_root, words, 0, value));
+        }
+
+        TopicTrie Erase(const std::string& bindingKey, const T& value) const
+        {
+            KeyTokens words;
+            StrHelper::Tokenize(words, bindingKey, '.');
+            return TopicTrie(erase(_root, words, 0, value));
+        }
+
+        // 一次遍历路由键，收集所有匹配的绑定
+        void Match(std::string_view routingKey, std::vector<T>& result) const
+        {
+            if(!_root)  return;
+
+            KeyTokens words;
+            StrHelper::Tokenize(words, routingKey, '.');
 
-            std::vector<std::string> bkeys, rkeys;
-            StrHelper::Split(bkeys, bindingKey, ".");
-            StrHelper::Split(rkeys, routingKey, ".");
+            bool multipath = false;
+            match(_root.get(), words, 0, result, multipath);
+            if(multipath && result.size() > 1)
+            {   // 经过 '#' 时同一绑定可能由多条路径命中
+                std::sort(result.begin(), result.end());
+                result.erase(std::unique(result.begin(), result.end()), result.end());
+            }
+        }
+
+        bool Empty() const { return !_root; }
+
+    private:
+        explicit TopicTrie(NodePtr root) :_root(std::move(root)) {}
+
+        static NodePtr insert(const NodePtr& node, const KeyTokens& words, size_t i, const T& value)
+        {
+            auto copy = node ? std::make_shared<Node>(*node) : std::make_shared<Node>();
+            if(i == words.size())
+            {
+                copy->values.push_back(value);
+                return copy;
+            }
+
+            NodePtr& slot = child(*copy, words[i]);
+            slot = insert(slot, words, i + 1, value);
+            return copy;
+        }
+
+        static NodePtr erase(const NodePtr& node, const KeyTokens& words, size_t i, const T& value)
+        {
+            if(!node)   return node;
+
+            auto copy = std::make_shared<Node>(*node);
+            if(i == words.size())
+            {
+                std::erase(copy->values, value);
+            }
+            else
+            {
+                NodePtr& slot = child(*copy, words[i]);
+                slot = erase(slot, words, i + 1, value);
+                if(!slot && words[i] != "*" && words[i] != "#")
+                    copy->children.erase(copy->children.find(words[i]));
+            }
 
-            int n = bkeys.size();
-            int m = rkeys.size();
+            // 剪掉空节点
+            if(copy->values.empty() && copy->children.empty() && !copy->star && !copy->hash)
+                return NodePtr();
+            return copy;
+        }
+
+        static NodePtr& child(Node& node, std::string_view word)
+        {
+            if(word == "*") return node.star;
+            if(word == "#") return node.hash;
+            auto it = node.children.find(word);
+            if(it == node.children.end())
+                it = node.children.emplace(std::string(word), NodePtr()).first;
+            return it->second;
+        }
+
+        static void match(const Node* node, const KeyTokens& words, size_t i,
+                          std::vector<T>& result, bool& multipath)
+        {
+            if(node->hash)
+            {
+                multipath = true;
+                for(size_t k = i; k <= words.size(); ++k)
+                    match(node->hash.get(), words, k, result, multipath);
+            }
+
+            if(i == words.size())
+            {
+                result.insert(result.end(), node->values.begin(), node->values.end());
+                return;
+            }
+
+            auto it = node->children.find(words[i]);
+            if(it != node->children.end())
+                match(it->second.get(), words, i + 1, result, multipath);
+            if(node->star)
+                match(node->star.get(), words, i + 1, result, multipath);
+        }
+
+    private:
+        NodePtr _root;
+    };
+
+    // 头部交换机的绑定索引。绑定时把谓词拆成 (属性, 值) 对，登记到倒排表：
+    //   属性 -> 值 -> 要求该对的绑定槽位
+    // 匹配时只遍历一次消息头部，对命中的槽位计数，x-match=all 要求计数等于谓词数，
+    // any 要求计数大于 0，整个过程不逐个绑定比较字符串。
+    // 与 TopicTrie 一样按值复制，倒排表共享未修改的部分。
+    template<typename T>
+    class HeadersIndex
+    {
+    public:
+        using Headers = google::protobuf::Map<std::string, std::string>;
 
-            std::vector<std::vector<bool>> dp(n + 1, std::vector<bool>(m + 1, false));
-            dp[0][0] = true;
+        HeadersIndex() = default;
 
-            for (int i = 1; i <= n; ++i) {
-                if (bkeys[i - 1] == "#") {
-                    dp[i][0] = true;
+        // 解析绑定参数：x-match 取 all（默认）或 any，其余不以 "x-" 开头的项作为谓词
+        void Insert(const Headers& args, const T& value)
+        {
+            bool any = false;
+            auto mit = args.find("x-match");
+            if(mit != args.end() && mit->second == "any")
+                any = true;
+
+            uint32_t slot = allocate();
+            Entry& entry = _entries[slot];
+            entry.value = value;
+            entry.any = any;
+            entry.need = 0;
+            entry.alive = true;
+
+            for(auto& it : args)
+            {
+                if(it.first.starts_with("x-"))  continue;
+                auto& values = _postings[it.first];
+                auto& list = values[it.second];
+                auto next = list ? std::make_shared<Posting>(*list) : std::make_shared<Posting>();
+                next->push_back(slot);
+                list = std::move(next);
+                ++entry.need;
+            }
+
+            // all 且没有谓词：匹配所有消息
+            if(!any && entry.need == 0)
+                _always.push_back(slot);
+        }
+
+        void Erase(const T& value)
+        {
+            for(uint32_t slot = 0; slot < _entries.size(); ++slot)
+            {
+                if(!_entries[slot].alive || !(_entries[slot].value == value))
                     continue;
+
+                std::erase(_always, slot);
+                for(auto pit = _postings.begin(); pit != _postings.end(); )
+                {
+                    auto& values = pit->second;
+                    for(auto vit = values.begin(); vit != values.end(); )
+                    {
+                        if(std::find(vit->second->begin(), vit->second->end(), slot) == vit->second->end())
+                        {
+                            ++vit;
+                            continue;
+                        }
+                        auto next = std::make_shared<Posting>(*vit->second);
+                        std::erase(*next, slot);
+                        if(next->empty())  vit = values.erase(vit);
+                        else { vit->second = std::move(next); ++vit; }
+                    }
+                    if(values.empty())  pit = _postings.erase(pit);
+                    else ++pit;
                 }
-                break;
+
+                _entries[slot] = Entry();
+                _free.push_back(slot);
+                return;
             }
+        }
 
-            for (int i = 1; i <= n; ++i) {
-                for (int j = 1; j <= m; ++j) {
-                    if (bkeys[i - 1] == rkeys[j - 1] || bkeys[i - 1] == "*")
-                        dp[i][j] = true;
-                    else if (bkeys[i - 1] == "#")
-                        dp[i][j] = dp[i - 1][j] | dp[i - 1][j - 1] | dp[i][j - 1];
+        void Match(const Headers& headers, std::vector<T>& result) const
+        {
+            for(auto slot : _always)
+                result.push_back(_entries[slot].value);
+            if(_postings.empty())   return;
+
+            // 计数数组按线程复用，只清理本次触及的槽位
+            thread_local std::vector<uint32_t> counts;
+            thread_local std::vector<uint32_t> touched;
+            if(counts.size() < _entries.size())
+                counts.resize(_entries.size(), 0);
+            touched.clear();
+
+            for(auto& it : headers)
+            {
+                auto pit = _postings.find(it.first);
+                if(pit == _postings.end())  continue;
+                auto vit = pit->second.find(it.second);
+                if(vit == pit->second.end())    continue;
+
+                for(auto slot : *vit->second)
+                {
+                    if(counts[slot]++ == 0)
+                        touched.push_back(slot);
                 }
             }
 
-            return dp[n][m];
+            for(auto slot : touched)
+            {
+                const Entry& entry = _entries[slot];
+                if(entry.any || counts[slot] == entry.need)
+                    result.push_back(entry.value);
+                counts[slot] = 0;
+            }
+        }
+
+        bool Empty() const { return _entries.size() == _free.size(); }
+
+    private:
+        struct Entry
+        {
+            T value{};
+            uint32_t need = 0;      // 谓词个数
+            bool any = false;
+            bool alive = false;
         };
+
+        using Posting = std::vector<uint32_t>;
+        using PostingPtr = std::shared_ptr<const Posting>;
+
+        uint32_t allocate()
+        {
+            if(!_free.empty())
+            {
+                uint32_t slot = _free.back();
+                _free.pop_back();
+                return slot;
+            }
+            _entries.emplace_back();
+            return _entries.size() - 1;
+        }
+
+    private:
+        std::vector<Entry> _entries;            // 槽位 -> 绑定
+        std::vector<uint32_t> _free;            // 已释放的槽位
+        std::vector<uint32_t> _always;          // 无条件匹配的槽位
+        std::unordered_map<std::string, std::unordered_map<std::string, PostingPtr>> _postings;
+    };
+
+    // 一致性哈希环：每个绑定按权重放置若干虚拟节点，消息键哈希后顺时针取第一个节点。
+    // 增删一个绑定只影响与其虚拟节点相邻的那部分键。
+    template<typename T>
+    class HashRing
+    {
+    public:
+        static constexpr uint32_t VNODES_PER_WEIGHT = 64;
+
+        void Insert(const std::string& name, uint32_t weight, const T& value)
+        {
+            auto next = std::make_shared<Ring>(*_ring);
+            for(uint32_t i = 0; i < weight * VNODES_PER_WEIGHT; ++i)
+                next->push_back(Node{Hash(name + "#" + std::to_string(i)), value});
+            std::sort(next->begin(), next->end(), [](const Node& a, const Node& b) { return a.point < b.point; });
+            _ring = std::move(next);
+        }
+
+        template<typename Pred>
+        void EraseIf(Pred pred)
+        {
+            auto next = std::make_shared<Ring>(*_ring);
+            std::erase_if(*next, [&pred](const Node& node) { return pred(node.value); });
+            _ring = std::move(next);
+        }
+
+        // 环为空时返回默认值
+        T Locate(std::string_view key) const
+        {
+            if(_ring->empty())  return T();
+            uint64_t point = Hash(key);
+            auto it = std::lower_bound(_ring->begin(), _ring->end(), point,
+                                       [](const Node& node, uint64_t p) { return node.point < p; });
+            if(it == _ring->end())  it = _ring->begin();
+            return it->value;
+        }
+
+        bool Empty() const { return _ring->empty(); }
+
+        // FNV-1a 再做一次 64 位混合，结果不随进程或平台变化
+        static uint64_t Hash(std::string_view key)
+        {
+            uint64_t h = 14695981039346656037ULL;
+            for(unsigned char ch : key)
+            {
+                h ^= ch;
+                h *= 1099511628211ULL;
+            }
+            h ^= h >> 33;
+            h *= 0xff51afd7ed558ccdULL;
+            h ^= h >> 33;
+            h *= 0xc4ceb9fe1a85ec53ULL;
+            h ^= h >> 33;
+            return h;
+        }
+
+    private:
+        struct Node
+        {
+            uint64_t point;
+            T value;
+        };
+        using Ring = std::vector<Node>;
+
+        std::shared_ptr<const Ring> _ring = std::make_shared<const Ring>();
+    };
+
+    // 路由结果缓存：路由键 -> 匹配结果，直接映射、容量固定，冲突时后写覆盖。
+    // 每项记录写入时的拓扑版本号，版本不一致即视为失效，无需主动清空。
+    template<typename V>
+    class RouteCache
+    {
+    private:
+        struct Entry
+        {
+            uint64_t generation;
+            std::string key;
+            V value;
+        };
+        using EntryPtr = std::shared_ptr<const Entry>;
+
+        size_t _mask;
+        std::once_flag _init;
+        std::atomic<bool> _ready{false};
+        std::unique_ptr<std::atomic<EntryPtr>[]> _slots;     // 首次写入时才分配
+
+    public:
+        explicit RouteCache(size_t capacity = 1024)
+        {
+            size_t n = 1;
+            while(n < capacity)    n <<= 1;
+            _mask = n - 1;
+        }
+
+        // 未命中返回默认值
+        V Lookup(const std::string& key, uint64_t generation) const
+        {
+            if(!_ready.load(std::memory_order_acquire))   return V();
+
+            auto entry = _slots[slot(key)].load();
+            if(entry && entry->generation == generation && entry->key == key)
+                return entry->value;
+            return V();
+        }
+
+        void Store(const std::string& key, uint64_t generation, const V& value)
+        {
+            std::call_once(_init, [this] {
+                _slots.reset(new std::atomic<EntryPtr>[_mask + 1]);
+                _ready.store(true, std::memory_order_release);
+            });
+            _slots[slot(key)].store(std::make_shared<const Entry>(Entry{generation, key, value}));
+        }
+
+    private:
+        size_t slot(const std::string& key) const
+        {
+            return std::hash<std::string>{}(key) & _mask;
+        }
     };
-}
\ No newline at end of file
+}
@@ -4,12 +4,20 @@
 
 #include "broker.hpp"
 
-int main()
+int main(int argc, char* argv[])
 {
     using namespace MyMQ;
     system("pwd");
 
-    Server server(8888, "./data/");
+    // --meta=journal 使用日志元数据后端，默认 SQLite
+    MetaBackend backend = MetaBackend::SQLITE;
+    for(int i = 1; i < argc; ++i)
+    {
+        if(std::string(argv[i]) == "--meta=journal")
+            backend = MetaBackend::JOURNAL;
+    }
+
+    Server server(8888, "./data/", backend);
     server.Start();
 
     return 0;
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "exchange.hpp"
+#include "msgqueue.hpp"
+#include "binding.hpp"
+
+// SQLite 元数据后端：三张表共用一个 meta.db 连接
+namespace MyMQ
+{
+    class SqliteMetaStore : public MetaStore
+    {
+    private:
+        SqliteHelperPtr _sql_helper;
+        ExchangeMapper _exchanges;
+        MsgQueueMapper _queues;
+        BindingMapper _bindings;
+
+    public:
+        explicit SqliteMetaStore(const std::string& dbfile)
+        :_sql_helper(open(dbfile)),
+        _exchanges(_sql_helper),
+        _queues(_sql_helper),
+        _bindings(_sql_helper)
+        {}
+
+        ~SqliteMetaStore() override
+        {
+            _sql_helper->Close();
+        }
+
+        bool Begin() override { return _sql_helper->Begin(); }
+        bool Commit() override { return _sql_helper->Commit(); }
+        bool Rollback() override { return _sql_helper->Rollback(); }
+
+        bool InsertExchange(const ExchangePtr& exp) override { return _exchanges.Insert(exp); }
+        void RemoveExchange(const std::string& name) override { _exchanges.Remove(name); }
+        ExchangeMap RecoveryExchanges() override { return _exchanges.Recovery(); }
+        void ClearExchanges() override
+        {
+            _exchanges.RemoveTable();
+            _exchanges.CreateTable();
+        }
+
+        bool InsertQueue(const MsgQueuePtr& mqp) override { return _queues.Insert(mqp); }
+        void RemoveQueue(const std::string& name) override { _queues.Remove(name); }
+        QueueMap RecoveryQueues() override { return _queues.Recovery(); }
+        void ClearQueues() override
+        {
+            _queues.RemoveTable();
+            _queues.CreateTable();
+        }
+
+        bool InsertBinding(const BindingPtr& bp) override { return _bindings.Insert(bp); }
+        void RemoveBinding(const std::string& ename, const std::string& qname) override { _bindings.Remove(ename, qname); }
+        void RemoveExchangeBindings(const std::string& ename) override { _bindings.RemoveExchangeBindings(ename); }
+        void RemoveMsgQueueBindings(const std::string& qname) override { _bindings.RemoveMsgQueueBindings(qname); }
+        BindingMap RecoveryBindings() override { return _bindings.Recovery(); }
+        void ClearBindings() override
+        {
+            _bindings.RemoveTable();
+            _bindings.CreateTable();
+        }
+
+    private:
+        static SqliteHelperPtr open(const std::string& dbfile)
+        {
+            FileHelper::CreateDirectory(FileHelper::ParentDirectory(dbfile));
+            auto helper = std::make_shared<SqliteHelper>(dbfile);
+            if(!helper->Open())
+            {
+                LOG_CRITICAL("元数据库 {} 打开失败", dbfile);
+                abort();
+            }
+            return helper;
+        }
+    };
+}